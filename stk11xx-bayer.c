@@ -168,8 +168,7 @@ int stk11xx_decompress(struct usb_stk11xx *dev)
 	if (framebuf == NULL)
 		return -EFAULT;
 
-	image  = dev->image_data;
-	image += dev->images[dev->fill_image].offset;
+	image = dev->read_image;
 
 	data = framebuf->data;
 
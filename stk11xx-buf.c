@@ -40,10 +40,13 @@
 #include <linux/kref.h>
 #include <linux/vmalloc.h>
 #include <linux/mm.h>
+#include <linux/atomic.h>
+#include <linux/dma-buf.h>
 
 #include <linux/usb.h>
 #include <media/v4l2-common.h>
 #include <media/v4l2-ioctl.h>
+#include <media/videobuf2-vmalloc.h>
 
 #include "stk11xx.h"
 
@@ -55,67 +58,6 @@
 static int default_nbrframebuf = 3;
 
 
-/** 
- * @param size Size of memory
- * 
- * @returns Address on the allocated memory
- *
- * @brief Allocate a buffer.
- *
- * This function permits to allocate a buffer in memory.
- */
-void * stk11xx_rvmalloc(unsigned long size)
-{
-	void *mem;
-	unsigned long addr;
-
-	size = PAGE_ALIGN(size);
-	mem = vmalloc_32(size);
-
-	if (!mem)
-		return NULL;
-
-	memset(mem, 0, size);
-
-	addr = (unsigned long) mem;
-
-	while (size > 0) {
-		SetPageReserved(vmalloc_to_page((void *) addr));
-		addr += PAGE_SIZE;
-		size -= PAGE_SIZE;
-	}
-
-	return mem;
-}
-
-
-/** 
- * @param mem Memory address
- * @param size Size of allocated memory
- *
- * @brief Free a buffer
- *
- * This function permits to free a buffer.
- */
-void stk11xx_rvfree(void *mem, unsigned long size)
-{
-	unsigned long addr;
-
-	if (!mem)
-		return;
-
-	addr = (unsigned long) mem;
-
-	while ((long) size > 0) {
-		ClearPageReserved(vmalloc_to_page((void *) addr));
-		addr += PAGE_SIZE;
-		size -= PAGE_SIZE;
-	}
-
-	vfree(mem);
-}
-
-
 /** 
  * @param dev Device structure
  * 
@@ -124,6 +66,10 @@ void stk11xx_rvfree(void *mem, unsigned long size)
  * @brief Allocate all ISOC buffers.
  *
  * This function permits to reserved the memory for each ISOC buffer.
+ *
+ * The frame buffers are sized from dev->frame_size, so the video mode must be
+ * selected first. Buffers already allocated are kept as long as they are large
+ * enough for the current mode.
  */
 int stk11xx_allocate_buffers(struct usb_stk11xx *dev)
 {
@@ -165,47 +111,81 @@ int stk11xx_allocate_buffers(struct usb_stk11xx *dev)
 		dev->framebuf = kbuf;
 	}
 
-	// Create frame buffers and make circular ring
+	// The frame buffers are too small for the new mode
+	if (dev->framebuf_size < dev->frame_size) {
+		for (i=0; i<default_nbrframebuf; i++) {
+			vfree(dev->framebuf[i].data);
+			dev->framebuf[i].data = NULL;
+		}
+
+		dev->framebuf_size = dev->frame_size;
+	}
+
+	// Create frame buffers
 	for (i=0; i<default_nbrframebuf; i++) {
 		if (dev->framebuf[i].data == NULL) {
-			kbuf = vmalloc(STK11XX_FRAME_SIZE);
+			kbuf = vmalloc(dev->framebuf_size);
 
 			if (kbuf == NULL) {
 				STK_ERROR("Failed to allocate frame buffer %d\n", i);
 				return -ENOMEM;
 			}
 
-			STK_DEBUG("Allocated frame buffer %d at %p.\n", i, kbuf);
+			STK_DEBUG("Allocated frame buffer %d at %p (%d bytes).\n", i, kbuf, dev->framebuf_size);
 
 			dev->framebuf[i].data = kbuf;
-			memset(kbuf, 0, STK11XX_FRAME_SIZE);
 		}
 	}
 
-	// Allocate image buffer; double buffer for mmap()
-	kbuf = stk11xx_rvmalloc(dev->nbuffers * dev->len_per_image);
+	return 0;
+}
 
-	if (kbuf == NULL) {
-		STK_ERROR("Failed to allocate image buffer(s). needed (%d)\n",
-				dev->nbuffers * dev->len_per_image);
-		return -ENOMEM;
-	}
 
-	STK_DEBUG("Allocated image buffer at %p\n", kbuf);
+/** 
+ * @param ring Frame ring
+ * @param index Index of the frame buffer
+ *
+ * @brief Publish a frame buffer in a ring.
+ *
+ * Only one context may push into a given ring : the isoc handler for the
+ * full ring, the reader for the free ring.
+ */
+static void stk11xx_ring_push(struct stk11xx_frame_ring *ring, int index)
+{
+	unsigned int head = ring->head;
 
-	dev->image_data = kbuf;
+	ring->slot[head & (STK11XX_FRAME_RING_SIZE - 1)] = index;
 
-	for (i = 0; i < dev->nbuffers; i++) {
-		dev->images[i].offset = i * dev->len_per_image;
-		dev->images[i].vma_use_count = 0;
-	}
+	// Frame data and slot must be visible before the new head
+	smp_store_release(&ring->head, head + 1);
+}
 
-	for (; i < STK11XX_MAX_IMAGES; i++)
-		dev->images[i].offset = 0;
 
-	kbuf = NULL;
-	
-	return 0;
+/** 
+ * @param ring Frame ring
+ *
+ * @returns Index of the frame buffer, or -1 if the ring is empty
+ *
+ * @brief Take the oldest frame buffer from a ring.
+ *
+ * The tail is advanced with a compare-and-swap, so the reader and the isoc
+ * handler (when it drops the oldest frame) can both take from the full ring.
+ */
+static int stk11xx_ring_pop(struct stk11xx_frame_ring *ring)
+{
+	int index;
+	unsigned int tail;
+
+	do {
+		tail = READ_ONCE(ring->tail);
+
+		if (tail == smp_load_acquire(&ring->head))
+			return -1;
+
+		index = ring->slot[tail & (STK11XX_FRAME_RING_SIZE - 1)];
+	} while (cmpxchg(&ring->tail, tail, tail + 1) != tail);
+
+	return index;
 }
 
 
@@ -216,65 +196,35 @@ int stk11xx_allocate_buffers(struct usb_stk11xx *dev)
  *
  * @brief Reset all ISOC buffers.
  *
- * This function permits to reset all ISOC buffers.
+ * This function permits to reset all ISOC buffers. It must be called while
+ * the isochronous pipe is stopped.
  */
 int stk11xx_reset_buffers(struct usb_stk11xx *dev)
 {
 	int i;
-	unsigned long flags;
 
 	STK_DEBUG("Reset all buffers\n");
 
-	spin_lock_irqsave(&dev->spinlock, flags);
+	dev->full_ring.head = 0;
+	dev->full_ring.tail = 0;
+	dev->free_ring.head = 0;
+	dev->free_ring.tail = 0;
 
-	dev->full_frames = NULL;
-	dev->full_frames_tail = NULL;
-
-	for (i=0; i<dev->nbuffers; i++) {
+	for (i=0; i<default_nbrframebuf; i++) {
 		dev->framebuf[i].filled = 0;
 		dev->framebuf[i].errors = 0;
 
 		if (i > 0)
-			dev->framebuf[i].next = &dev->framebuf[i - 1];
-		else
-			dev->framebuf->next = NULL;
+			stk11xx_ring_push(&dev->free_ring, i);
 	}
 
-	dev->empty_frames = &dev->framebuf[dev->nbuffers - 1];
-	dev->empty_frames_tail = dev->framebuf;
 	dev->read_frame = NULL;
-	dev->fill_frame = dev->empty_frames;
-	dev->empty_frames = dev->empty_frames->next;
-
-	dev->image_read_pos = 0;
-	dev->fill_image = 0;
-
-	spin_unlock_irqrestore(&dev->spinlock, flags);
-
-	for (i=0; i<dev->nbuffers; i++)
-		dev->image_used[i] = 0;
+	dev->fill_frame = &dev->framebuf[0];
 	
 	return 0;
 }
 
 
-/** 
- * @param dev Device structure
- * 
- * @returns 0 if all is OK
- *
- * @brief Clear current buffers.
- *
- * This function permits to clear the memory.
- */
-int stk11xx_clear_buffers(struct usb_stk11xx *dev)
-{
-	memset(dev->image_data, 0x00, dev->nbuffers * dev->len_per_image);
-
-	return 0;
-}
-
-
 /** 
  * @param dev Device structure
  * 
@@ -293,8 +243,13 @@ int stk11xx_free_buffers(struct usb_stk11xx *dev)
 	if (dev == NULL)
 		return -1;
 
-	// Release iso pipe buffers
+	// Release iso pipe buffers and URBs (the pipe must be stopped)
 	for (i=0; i<MAX_ISO_BUFS; i++) {
+		if (dev->isobuf[i].urb != NULL) {
+			usb_free_urb(dev->isobuf[i].urb);
+			dev->isobuf[i].urb = NULL;
+		}
+
 		if (dev->isobuf[i].data != NULL) {
 			kfree(dev->isobuf[i].data);
 			dev->isobuf[i].data = NULL;
@@ -314,11 +269,7 @@ int stk11xx_free_buffers(struct usb_stk11xx *dev)
 		dev->framebuf = NULL;
 	}
 
-	// Release image buffers
-	if (dev->image_data != NULL)
-		stk11xx_rvfree(dev->image_data, dev->nbuffers * dev->len_per_image);
-
-	dev->image_data = NULL;
+	dev->framebuf_size = 0;
 
 	return 0;
 }
@@ -326,17 +277,103 @@ int stk11xx_free_buffers(struct usb_stk11xx *dev)
 
 /** 
  * @param dev Device structure
+ * 
+ * @returns Number of pages held by the buffer pool
+ *
+ * @brief Size of the buffer pool.
+ */
+static unsigned long stk11xx_buffer_pool_pages(struct usb_stk11xx *dev)
+{
+	int i;
+	unsigned long size = 0;
+
+	for (i=0; i<MAX_ISO_BUFS; i++) {
+		if (dev->isobuf[i].data != NULL)
+			size += ISO_BUFFER_SIZE;
+	}
+
+	if (dev->framebuf != NULL) {
+		for (i=0; i<default_nbrframebuf; i++) {
+			if (dev->framebuf[i].data != NULL)
+				size += dev->framebuf_size;
+		}
+	}
+
+	return size >> PAGE_SHIFT;
+}
+
+
+/** 
+ * @param shrink Shrinker of the device
+ * 
+ * @returns Device structure
  *
- * @brief Prepare the next image.
+ * @brief Get the device of a shrinker.
  *
- * This function is called when an image is ready, so as to prepare the next image.
+ * The shrinkers are allocated by the VM since Linux 6.7.
  */
-void stk11xx_next_image(struct usb_stk11xx *dev)
+static struct usb_stk11xx * stk11xx_shrinker_dev(struct shrinker *shrink)
 {
-	STK_STREAM("Select next image\n");
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,7,0)
+	return shrink->private_data;
+#else
+	return container_of(shrink, struct usb_stk11xx, shrinker);
+#endif
+}
+
+
+/** 
+ * @param shrink Shrinker of the device
+ * @param sc Shrink control
+ * 
+ * @returns Number of pages which can be released
+ *
+ * @brief Count the pages of an idle buffer pool.
+ *
+ * The buffers are kept when the capture stops, so that the next one
+ * doesn't have to allocate them again. They are only given back under
+ * memory pressure, and never while the camera streams.
+ */
+static unsigned long stk11xx_buffer_pool_count(struct shrinker *shrink,
+		struct shrink_control *sc)
+{
+	struct usb_stk11xx *dev = stk11xx_shrinker_dev(shrink);
+
+	if (dev->streaming)
+		return 0;
+
+	return stk11xx_buffer_pool_pages(dev);
+}
+
+
+/** 
+ * @param shrink Shrinker of the device
+ * @param sc Shrink control
+ * 
+ * @returns Number of pages released
+ *
+ * @brief Release an idle buffer pool.
+ */
+static unsigned long stk11xx_buffer_pool_scan(struct shrinker *shrink,
+		struct shrink_control *sc)
+{
+	unsigned long pages = 0;
+	struct usb_stk11xx *dev = stk11xx_shrinker_dev(shrink);
+
+	if (!mutex_trylock(&dev->modlock))
+		return SHRINK_STOP;
+
+	if (!dev->streaming) {
+		pages = stk11xx_buffer_pool_pages(dev);
+
+		STK_DEBUG("Release the idle buffer pool (%lu pages)\n", pages);
+
+		stk11xx_free_buffers(dev);
+	}
+
+	mutex_unlock(&dev->modlock);
 
-	dev->image_used[dev->fill_image] = 0;
-	dev->fill_image = (dev->fill_image + 1) % dev->nbuffers;
+	return pages ? pages : SHRINK_STOP;
 }
 
 
@@ -345,108 +382,681 @@ void stk11xx_next_image(struct usb_stk11xx *dev)
  * 
  * @returns 0 if all is OK
  *
+ * @brief Register the buffer pool of the device with the VM.
+ */
+int stk11xx_register_buffer_pool(struct usb_stk11xx *dev)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,7,0)
+	dev->shrinker = shrinker_alloc(0, "stk11xx-%s", dev_name(dev->parent));
+
+	if (dev->shrinker == NULL)
+		return -ENOMEM;
+
+	dev->shrinker->count_objects = stk11xx_buffer_pool_count;
+	dev->shrinker->scan_objects = stk11xx_buffer_pool_scan;
+	dev->shrinker->seeks = DEFAULT_SEEKS;
+	dev->shrinker->private_data = dev;
+
+	shrinker_register(dev->shrinker);
+
+	return 0;
+#else
+	dev->shrinker.count_objects = stk11xx_buffer_pool_count;
+	dev->shrinker.scan_objects = stk11xx_buffer_pool_scan;
+	dev->shrinker.seeks = DEFAULT_SEEKS;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,0,0)
+	return register_shrinker(&dev->shrinker, "stk11xx-%s", dev_name(dev->parent));
+#else
+	return register_shrinker(&dev->shrinker);
+#endif
+#endif
+}
+
+
+/** 
+ * @param dev Device structure
+ *
+ * @brief Unregister and release the buffer pool of the device.
+ *
+ * This function is called when the device is disconnected.
+ */
+void stk11xx_unregister_buffer_pool(struct usb_stk11xx *dev)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,7,0)
+	shrinker_free(dev->shrinker);
+#else
+	unregister_shrinker(&dev->shrinker);
+#endif
+
+	mutex_lock(&dev->modlock);
+	stk11xx_free_buffers(dev);
+	mutex_unlock(&dev->modlock);
+}
+
+
+/** 
+ * @param dev Device structure
+ * @param framebuf Completed frame
+ * 
+ * @returns 1 if the frame is wanted, 0 if it comes too early
+ *
+ * @brief Thin out the frames to the frame rate wished.
+ *
+ * This function is called by the isoc handler when a frame is completed. A
+ * frame is wanted when it starts at the due time, give or take a quarter of
+ * the frame interval. The due time then moves forward by one interval, or
+ * restarts from this frame if the stream is late.
+ */
+int stk11xx_frame_wanted(struct usb_stk11xx *dev, struct stk11xx_frame_buf *framebuf)
+{
+	u64 interval = READ_ONCE(dev->frame_interval);
+
+	if (interval == 0)
+		return 1;
+
+	if ((s64) (framebuf->timestamp + interval / 4 - dev->frame_due) < 0)
+		return 0;
+
+	dev->frame_due += interval;
+
+	if ((s64) (dev->frame_due - framebuf->timestamp) < 0)
+		dev->frame_due = framebuf->timestamp + interval;
+
+	return 1;
+}
+
+
+/** 
+ * @param dev Device structure
+ * 
+ * @returns 0 if all is OK, 1 if the oldest frame has been dropped
+ *
  * @brief Prepare the next frame.
  *
- * This function is called when a frame is ready, so as to prepare the next frame.
+ * This function is called by the isoc handler when a frame is ready, so as to
+ * prepare the next frame. If the reader has no free frame to give back, the
+ * oldest completed frame is recycled.
  */
 int stk11xx_next_frame(struct usb_stk11xx *dev)
 {
 	int ret = 0;
-	unsigned long flags;
+	int index;
 
 	STK_STREAM("Select next frame\n");
 
-	spin_lock_irqsave(&dev->spinlock, flags);
+	index = stk11xx_ring_pop(&dev->free_ring);
 
-	if (dev->fill_frame != NULL) {
-		if (dev->full_frames == NULL) {
-			dev->full_frames = dev->fill_frame;
-			dev->full_frames_tail = dev->full_frames;
-		}
-		else {
-			dev->full_frames_tail->next = dev->fill_frame;
-			dev->full_frames_tail = dev->fill_frame;
-		}
+	if (index < 0) {
+		index = stk11xx_ring_pop(&dev->full_ring);
+		ret = 1;
 	}
 
-	if (dev->empty_frames != NULL) {
-		dev->fill_frame = dev->empty_frames;
-		dev->empty_frames = dev->empty_frames->next;
+	if (index < 0) {
+		// Keep filling the current frame, it is lost
+		STK_ERROR("Neither empty or full frames available!\n");
+		return -EINVAL;
 	}
-	else {
-		if (dev->full_frames == NULL) {
-			STK_ERROR("Neither empty or full frames available!\n");
-			spin_unlock_irqrestore(&dev->spinlock, flags);
-			return -EINVAL;
-		}
 
-		dev->fill_frame = dev->full_frames;
-		dev->full_frames = dev->full_frames->next;
+	stk11xx_ring_push(&dev->full_ring, dev->fill_frame - dev->framebuf);
 
-		ret = 1;
+	dev->fill_frame = &dev->framebuf[index];
+
+	return ret;
+}
+
+
+/** 
+ * @param dev Device structure
+ * 
+ * @returns 1 if a completed frame is waiting
+ *
+ * @brief Check if a frame can be handled.
+ */
+int stk11xx_frame_ready(struct usb_stk11xx *dev)
+{
+	struct stk11xx_frame_ring *ring = &dev->full_ring;
+
+	return READ_ONCE(ring->tail) != smp_load_acquire(&ring->head);
+}
+
+
+/** 
+ * @param fh Consumer
+ * 
+ * @returns The oldest queued buffer, or NULL
+ *
+ * @brief Take the next buffer to fill.
+ */
+static struct stk11xx_buffer *stk11xx_next_buffer(struct stk11xx_fh *fh)
+{
+	unsigned long flags;
+	struct stk11xx_buffer *buf = NULL;
+
+	spin_lock_irqsave(&fh->buf_lock, flags);
+
+	if (!list_empty(&fh->buf_list)) {
+		buf = list_first_entry(&fh->buf_list, struct stk11xx_buffer, list);
+		list_del(&buf->list);
 	}
 
-	dev->fill_frame->next = NULL;
+	spin_unlock_irqrestore(&fh->buf_lock, flags);
+
+	return buf;
+}
 
-	spin_unlock_irqrestore(&dev->spinlock, flags);
+
+/** 
+ * @param dev Device structure
+ * 
+ * @returns 1 if a streaming consumer has queued a buffer
+ *
+ * @brief Check if a completed frame can be given to someone.
+ *
+ * dev->fh_lock must be held.
+ */
+static int stk11xx_buffer_waiting(struct usb_stk11xx *dev)
+{
+	int ret = 0;
+	unsigned long flags;
+	struct stk11xx_fh *fh;
+
+	list_for_each_entry(fh, &dev->fh_list, list) {
+		if (!fh->streaming)
+			continue;
+
+		spin_lock_irqsave(&fh->buf_lock, flags);
+		ret = !list_empty(&fh->buf_list);
+		spin_unlock_irqrestore(&fh->buf_lock, flags);
+
+		if (ret)
+			break;
+	}
 
 	return ret;
 }
 
 
 /** 
- * @param dev Device structure
+ * @param buf Capture buffer
  * 
  * @returns 0 if all is OK
  *
+ * @brief Give a buffer to the CPU before the image is written.
+ *
+ * An imported dma-buf may be cached or shared with a device : the exporter
+ * syncs it around the accesses of the CPU. The vmalloc memory of videobuf2
+ * has no prepare/finish sync, so it's done here.
+ */
+static int stk11xx_begin_cpu_access(struct stk11xx_buffer *buf)
+{
+	struct vb2_buffer *vb = &buf->vb.vb2_buf;
+
+	if (vb->memory != VB2_MEMORY_DMABUF)
+		return 0;
+
+	return dma_buf_begin_cpu_access(vb->planes[0].dbuf, DMA_TO_DEVICE);
+}
+
+
+/** 
+ * @param buf Capture buffer
+ *
+ * @brief Give a buffer back to its device after the image is written.
+ */
+static void stk11xx_end_cpu_access(struct stk11xx_buffer *buf)
+{
+	struct vb2_buffer *vb = &buf->vb.vb2_buf;
+
+	if (vb->memory != VB2_MEMORY_DMABUF)
+		return;
+
+	dma_buf_end_cpu_access(vb->planes[0].dbuf, DMA_TO_DEVICE);
+}
+
+
+/** 
+ * @param dev Device structure
+ * 
+ * @returns 0 if all is OK, -EAGAIN if no frame is ready
+ *
  * @brief Handler frame
  *
- * This function gets called for the isochronous pipe. This function is only called 
- * when a frame is ready. So we have to be fast to decompress the data.
+ * This function gives the oldest completed frame to all the streaming
+ * consumers, then gives the frame back to the isoc handler. The frame is
+ * converted only once, in the buffer of the first consumer, and copied in
+ * the buffers of the others. A consumer which has no buffer queued loses the
+ * frame, the others don't wait for it.
+ *
+ * Each buffer gets the time of the first packet of the frame and its sequence
+ * number since the STREAMON of its consumer, so the dropped frames show up as
+ * gaps.
+ *
+ * dev->fh_lock must be held. VIDIOC_S_FMT changes the palette or the size of
+ * a running stream under it, so each frame is converted in a single format.
  */
 int stk11xx_handle_frame(struct usb_stk11xx *dev)
 {
-	int ret = 0;
-	unsigned long flags;
+	int ret;
+	int index;
+	void *image;
+	void *converted = NULL;
+	struct stk11xx_fh *fh;
+	struct stk11xx_buffer *buf;
+	struct stk11xx_buffer *next;
+	struct stk11xx_frame_buf *framebuf;
+	LIST_HEAD(done);
 
 	STK_STREAM("Sync Handle Frame\n");
 
-	spin_lock_irqsave(&dev->spinlock, flags);
+	index = stk11xx_ring_pop(&dev->full_ring);
+
+	if (index < 0)
+		return -EAGAIN;
+
+	framebuf = &dev->framebuf[index];
+
+	list_for_each_entry(fh, &dev->fh_list, list) {
+		if (!fh->streaming)
+			continue;
+
+		// Frame completed before this consumer started
+		if ((int) (framebuf->sequence - fh->sequence_base) < 0)
+			continue;
+
+		buf = stk11xx_next_buffer(fh);
+
+		if (buf == NULL) {
+			fh->frames_dropped++;
+			continue;
+		}
+
+		image = vb2_plane_vaddr(&buf->vb.vb2_buf, 0);
+
+		// A user or imported buffer which can't be mapped in the kernel,
+		// or a buffer queued for a previous format
+		if ((image == NULL) || (vb2_plane_size(&buf->vb.vb2_buf, 0) < dev->view_size))
+			ret = -EFAULT;
+		else
+			ret = stk11xx_begin_cpu_access(buf);
 
-	if (dev->read_frame != NULL) {
-		spin_unlock_irqrestore(&dev->spinlock, flags);
-		return ret;
+		if (ret == 0) {
+			if (converted != NULL)
+				memcpy(image, converted, dev->view_size);
+			else {
+				dev->read_frame = framebuf;
+				dev->read_image = image;
+
+				ret = dev_stk11xx_decompress(dev);
+
+				dev->read_image = NULL;
+				dev->read_frame = NULL;
+
+				if (ret == 0)
+					converted = image;
+			}
+
+			if (ret)
+				stk11xx_end_cpu_access(buf);
+		}
+
+		buf->vb.field = V4L2_FIELD_NONE;
+		buf->vb.sequence = framebuf->sequence - fh->sequence_base;
+		buf->vb.vb2_buf.timestamp = framebuf->timestamp;
+		vb2_set_plane_payload(&buf->vb.vb2_buf, 0, dev->view_size);
+
+		if (ret) {
+			vb2_buffer_done(&buf->vb.vb2_buf, VB2_BUF_STATE_ERROR);
+			continue;
+		}
+
+		fh->frames_done++;
+
+		// The converted image is copied until all the consumers are served
+		list_add_tail(&buf->list, &done);
+	}
+
+	// The converted image is read until here, the buffers are released together
+	list_for_each_entry_safe(buf, next, &done, list) {
+		list_del(&buf->list);
+		stk11xx_end_cpu_access(buf);
+		vb2_buffer_done(&buf->vb.vb2_buf, VB2_BUF_STATE_DONE);
 	}
 
-	if (dev->full_frames == NULL) {
+	stk11xx_ring_push(&dev->free_ring, index);
+
+	return 0;
+}
+
+
+/** 
+ * @param work Frame work of the device
+ *
+ * @brief Convert the completed frames.
+ *
+ * This work is scheduled by the isoc handler when a frame is completed, and
+ * when an application queues a buffer. The frames wait in the full ring
+ * while no consumer has a buffer queued.
+ */
+static void stk11xx_frame_work(struct work_struct *work)
+{
+	struct usb_stk11xx *dev = container_of(work, struct usb_stk11xx, frame_work);
+
+	mutex_lock(&dev->fh_lock);
+
+	while (stk11xx_frame_ready(dev) && stk11xx_buffer_waiting(dev)) {
+		// The frame has been recycled by the isoc handler in the meantime
+		if (stk11xx_handle_frame(dev) == -EAGAIN)
+			break;
 	}
+
+	mutex_unlock(&dev->fh_lock);
+}
+
+
+/** 
+ * @param vq Capture queue
+ * @param nbuffers Number of buffers wished
+ * @param nplanes Number of planes
+ * @param sizes Size of each plane
+ * @param alloc_devs Allocation devices
+ * 
+ * @returns 0 if all is OK
+ *
+ * @brief Negotiate the number and the size of the capture buffers.
+ */
+static int stk11xx_queue_setup(struct vb2_queue *vq, unsigned int *nbuffers,
+		unsigned int *nplanes, unsigned int sizes[], struct device *alloc_devs[])
+{
+	int err = 0;
+	struct stk11xx_fh *fh = vb2_get_drv_priv(vq);
+	struct usb_stk11xx *dev = fh->dev;
+
+	if (*nbuffers < STK11XX_MIN_IMAGES)
+		*nbuffers = STK11XX_MIN_IMAGES;
+	else if (*nbuffers > STK11XX_MAX_IMAGES)
+		*nbuffers = STK11XX_MAX_IMAGES;
+
+	// The format is changed by VIDIOC_S_FMT under modlock
+	mutex_lock(&dev->modlock);
+
+	if (*nplanes)
+		err = (sizes[0] < dev->view_size) ? -EINVAL : 0;
 	else {
-		dev->read_frame = dev->full_frames;
-		dev->full_frames = dev->full_frames->next;
-		dev->read_frame->next = NULL;
+		*nplanes = 1;
+		sizes[0] = dev->view_size;
 	}
 
-	if (dev->read_frame != NULL) {
-		spin_unlock_irqrestore(&dev->spinlock, flags);
-		ret = dev_stk11xx_decompress(dev);
-		spin_lock_irqsave(&dev->spinlock, flags);
+	mutex_unlock(&dev->modlock);
+
+	return err;
+}
 
-		if (dev->empty_frames == NULL) {
-			dev->empty_frames = dev->read_frame;
-			dev->empty_frames_tail = dev->empty_frames;
-		}
-		else {
-			dev->empty_frames_tail->next = dev->read_frame;
-			dev->empty_frames_tail = dev->read_frame;
-		}
 
-		dev->read_frame = NULL;
+/** 
+ * @param vb Capture buffer
+ * 
+ * @returns 0 if all is OK
+ *
+ * @brief Count a buffer which has its memory.
+ *
+ * VIDIOC_S_FMT is refused while a file has capture buffers. The count is
+ * kept under modlock, so the format can't change between the check of
+ * the size and the count of the buffer.
+ */
+static int stk11xx_buffer_init(struct vb2_buffer *vb)
+{
+	int err = 0;
+	struct stk11xx_fh *fh = vb2_get_drv_priv(vb->vb2_queue);
+	struct usb_stk11xx *dev = fh->dev;
+
+	mutex_lock(&dev->modlock);
+
+	if (vb2_plane_size(vb, 0) < dev->view_size)
+		err = -EINVAL;
+	else
+		dev->buffers_allocated++;
+
+	mutex_unlock(&dev->modlock);
+
+	return err;
+}
+
+
+/** 
+ * @param vb Capture buffer
+ *
+ * @brief Forget a buffer which releases its memory.
+ */
+static void stk11xx_buffer_cleanup(struct vb2_buffer *vb)
+{
+	struct stk11xx_fh *fh = vb2_get_drv_priv(vb->vb2_queue);
+	struct usb_stk11xx *dev = fh->dev;
+
+	mutex_lock(&dev->modlock);
+	dev->buffers_allocated--;
+	mutex_unlock(&dev->modlock);
+}
+
+
+/** 
+ * @param vb Capture buffer
+ * 
+ * @returns 0 if all is OK
+ *
+ * @brief Check a buffer before it's queued.
+ */
+static int stk11xx_buffer_prepare(struct vb2_buffer *vb)
+{
+	struct stk11xx_fh *fh = vb2_get_drv_priv(vb->vb2_queue);
+	struct usb_stk11xx *dev = fh->dev;
+
+	if (vb2_plane_size(vb, 0) < dev->view_size) {
+		STK_ERROR("Buffer too small (%lu < %d)\n", vb2_plane_size(vb, 0), dev->view_size);
+		return -EINVAL;
 	}
 
-	spin_unlock_irqrestore(&dev->spinlock, flags);
+	vb2_set_plane_payload(vb, 0, dev->view_size);
 
-	dev_stk11xx_watchdog_camera(dev);
+	return 0;
+}
 
-	return ret;
+
+/** 
+ * @param vb Capture buffer
+ *
+ * @brief Give a buffer to the driver.
+ */
+static void stk11xx_buffer_queue(struct vb2_buffer *vb)
+{
+	unsigned long flags;
+	struct stk11xx_fh *fh = vb2_get_drv_priv(vb->vb2_queue);
+	struct stk11xx_buffer *buf = container_of(to_vb2_v4l2_buffer(vb), struct stk11xx_buffer, vb);
+
+	spin_lock_irqsave(&fh->buf_lock, flags);
+	list_add_tail(&buf->list, &fh->buf_list);
+	spin_unlock_irqrestore(&fh->buf_lock, flags);
+
+	// A frame may be waiting for this buffer
+	if (READ_ONCE(fh->streaming))
+		schedule_work(&fh->dev->frame_work);
+}
+
+
+/** 
+ * @param vq Capture queue
+ * @param count Number of buffers already queued
+ * 
+ * @returns 0 if all is OK
+ *
+ * @brief Start the camera and fill the capture buffers.
+ *
+ * videobuf2 calls it on VIDIOC_STREAMON or on the first read(). The camera
+ * is started by the first consumer, the others join the running stream.
+ */
+static int stk11xx_start_streaming(struct vb2_queue *vq, unsigned int count)
+{
+	int err = 0;
+	struct stk11xx_buffer *buf;
+	struct stk11xx_fh *fh = vb2_get_drv_priv(vq);
+	struct usb_stk11xx *dev = fh->dev;
+
+	STK_DEBUG("Start streaming (%u buffers)\n", count);
+
+	mutex_lock(&dev->modlock);
+
+	// The camera only runs while the buffers are filled
+	if (dev->streaming == 0)
+		err = dev_stk11xx_start_video(dev);
+
+	if (!err) {
+		dev->streaming++;
+
+		mutex_lock(&dev->fh_lock);
+
+		// The sequence numbers restart from the next completed frame
+		fh->sequence_base = READ_ONCE(dev->frame_sequence);
+		fh->frames_done = 0;
+		fh->frames_dropped = 0;
+		fh->streaming = 1;
+
+		mutex_unlock(&dev->fh_lock);
+	}
+
+	mutex_unlock(&dev->modlock);
+
+	if (err) {
+		// videobuf2 wants the buffers back in the queued state
+		while ((buf = stk11xx_next_buffer(fh)) != NULL)
+			vb2_buffer_done(&buf->vb.vb2_buf, VB2_BUF_STATE_QUEUED);
+
+		return err;
+	}
+
+	schedule_work(&dev->frame_work);
+
+	return 0;
+}
+
+
+/** 
+ * @param vq Capture queue
+ *
+ * @brief Stop to fill the capture buffers.
+ *
+ * The buffers still queued are given back to videobuf2. The last consumer
+ * stops the camera.
+ */
+static void stk11xx_stop_streaming(struct vb2_queue *vq)
+{
+	int last;
+	struct stk11xx_buffer *buf;
+	struct stk11xx_fh *fh = vb2_get_drv_priv(vq);
+	struct usb_stk11xx *dev = fh->dev;
+
+	STK_DEBUG("Stop streaming (%u frames, %u dropped)\n", fh->frames_done, fh->frames_dropped);
+
+	mutex_lock(&dev->modlock);
+
+	// The frame work doesn't use the buffers of this consumer any more
+	mutex_lock(&dev->fh_lock);
+	fh->streaming = 0;
+	mutex_unlock(&dev->fh_lock);
+
+	dev->streaming--;
+	last = (dev->streaming == 0);
+
+	// Release the USB bandwidth and switch off the camera
+	if (last)
+		dev_stk11xx_stop_video(dev);
+
+	mutex_unlock(&dev->modlock);
+
+	if (last)
+		cancel_work_sync(&dev->frame_work);
+
+	while ((buf = stk11xx_next_buffer(fh)) != NULL)
+		vb2_buffer_done(&buf->vb.vb2_buf, VB2_BUF_STATE_ERROR);
 }
 
+
+/**
+ * @var stk11xx_queue_ops
+ *
+ * Callbacks of the capture queue
+ */
+static struct vb2_ops stk11xx_queue_ops = {
+	.queue_setup = stk11xx_queue_setup,
+	.buf_init = stk11xx_buffer_init,
+	.buf_cleanup = stk11xx_buffer_cleanup,
+	.buf_prepare = stk11xx_buffer_prepare,
+	.buf_queue = stk11xx_buffer_queue,
+	.start_streaming = stk11xx_start_streaming,
+	.stop_streaming = stk11xx_stop_streaming,
+	.wait_prepare = vb2_ops_wait_prepare,
+	.wait_finish = vb2_ops_wait_finish,
+};
+
+
+/** 
+ * @param dev Device structure
+ *
+ * @brief Initialize the list of the consumers.
+ *
+ * Several files can be opened on the device. The completed frames are
+ * converted once by the frame work and given to all the streaming files.
+ */
+void stk11xx_init_consumers(struct usb_stk11xx *dev)
+{
+	mutex_init(&dev->fh_lock);
+	INIT_LIST_HEAD(&dev->fh_list);
+	INIT_WORK(&dev->frame_work, stk11xx_frame_work);
+
+	dev->owner = NULL;
+	dev->buffers_allocated = 0;
+}
+
+
+/** 
+ * @param fh Opened file
+ * 
+ * @returns 0 if all is OK
+ *
+ * @brief Initialize the capture queue of an opened file.
+ *
+ * The capture buffers are allocated by videobuf2 with vmalloc. They can be
+ * exported as dma-buf, or provided by the application (USERPTR) or by another
+ * device (DMABUF), in which case the frames are converted directly into that
+ * memory.
+ *
+ * The queue is protected by fh->queue_lock, not by dev->modlock, and the lock
+ * is released while waiting for a buffer. So the controls and the format can
+ * be read while a reader is blocked in VIDIOC_DQBUF or read(). The queue
+ * takes modlock to start or stop the camera, so queue_lock is always taken
+ * first. A file never takes the queue_lock of another file: the buffers of
+ * all the files are counted in dev->buffers_allocated, under modlock.
+ */
+int stk11xx_init_queue(struct stk11xx_fh *fh)
+{
+	struct vb2_queue *q = &fh->vb_queue;
+
+	mutex_init(&fh->queue_lock);
+	INIT_LIST_HEAD(&fh->buf_list);
+	spin_lock_init(&fh->buf_lock);
+
+	q->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	q->io_modes = VB2_MMAP | VB2_USERPTR | VB2_DMABUF | VB2_READ;
+	q->drv_priv = fh;
+	q->buf_struct_size = sizeof(struct stk11xx_buffer);
+	q->ops = &stk11xx_queue_ops;
+	q->mem_ops = &vb2_vmalloc_memops;
+	q->timestamp_flags = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,8,0)
+	q->min_queued_buffers = STK11XX_MIN_IMAGES;
+#else
+	q->min_buffers_needed = STK11XX_MIN_IMAGES;
+#endif
+	q->lock = &fh->queue_lock;
+
+	return vb2_queue_init(q);
+}
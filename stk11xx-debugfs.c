@@ -0,0 +1,443 @@
+/**
+ * @file stk11xx-debugfs.c
+ * @author Nicolas VIVIEN
+ * @date 2026-10-18
+ * @version v2.2.x
+ *
+ * @brief Driver for Syntek USB video camera
+ *
+ * @note Copyright (C) Nicolas VIVIEN
+ *
+ * @par Licences
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ * @par SubVersion
+ *   $Date$
+ *   $Revision$
+ *   $Author$
+ *   $HeadURL$
+ */
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/version.h>
+#include <linux/errno.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h>
+#include <linux/debugfs.h>
+
+#include <linux/usb.h>
+#include <media/v4l2-common.h>
+#include <media/v4l2-ioctl.h>
+
+#include "stk11xx.h"
+
+
+extern const struct stk11xx_coord stk11xx_image_sizes[STK11XX_NBR_SIZES];
+
+
+/**
+ * @var stk11xx_debugfs_root
+ *   Directory of the driver in the debugfs
+ */
+static struct dentry *stk11xx_debugfs_root;
+
+
+/**
+ * @param dev Device structure
+ * @param mode New mode of the recorder
+ *
+ * @returns 0 if all is OK
+ *
+ * @brief Start, change or stop the isoc recorder.
+ *
+ * The ring is allocated when the recorder starts, and released (with the
+ * records not read) when it stops.
+ */
+static int stk11xx_record_mode(struct usb_stk11xx *dev, int mode)
+{
+	int err;
+	unsigned long flags;
+	void *buffer = NULL;
+
+	if ((mode < STK11XX_RECORD_OFF) || (mode > STK11XX_RECORD_PAYLOADS))
+		return -EINVAL;
+
+	mutex_lock(&dev->rec_mutex);
+
+	if ((mode != STK11XX_RECORD_OFF) && (dev->rec_buffer == NULL)) {
+		buffer = vmalloc(STK11XX_RECORD_SIZE);
+
+		if (buffer == NULL) {
+			mutex_unlock(&dev->rec_mutex);
+			return -ENOMEM;
+		}
+
+		err = kfifo_init(&dev->rec_fifo, buffer, STK11XX_RECORD_SIZE);
+
+		if (err) {
+			vfree(buffer);
+			mutex_unlock(&dev->rec_mutex);
+			return err;
+		}
+
+		dev->rec_buffer = buffer;
+		dev->rec_urbs = 0;
+		dev->rec_lost = 0;
+		buffer = NULL;
+	}
+
+	spin_lock_irqsave(&dev->rec_lock, flags);
+
+	dev->rec_mode = mode;
+
+	// The completion handler doesn't use the ring any more
+	if (mode == STK11XX_RECORD_OFF) {
+		buffer = dev->rec_buffer;
+		dev->rec_buffer = NULL;
+	}
+
+	spin_unlock_irqrestore(&dev->rec_lock, flags);
+
+	mutex_unlock(&dev->rec_mutex);
+
+	vfree(buffer);
+
+	// A reader gets the end of the stream
+	wake_up_interruptible(&dev->rec_wait);
+
+	return 0;
+}
+
+
+/**
+ * @param dev Device structure
+ * @param desc Packet descriptor
+ *
+ * @returns Bytes of the packet to record
+ */
+static unsigned int stk11xx_record_bytes(struct usb_stk11xx *dev, struct usb_iso_packet_descriptor *desc)
+{
+	if (desc->status != 0)
+		return 0;
+
+	if (dev->rec_mode == STK11XX_RECORD_HEADERS)
+		return min(desc->actual_length, (unsigned int) STK11XX_RECORD_HEADER);
+
+	return desc->actual_length;
+}
+
+
+/**
+ * @param dev Device structure
+ *
+ * @brief Record the start of a stream.
+ *
+ * The record gives what a player needs to decode the URBs which follow.
+ */
+void stk11xx_record_start(struct usb_stk11xx *dev)
+{
+	unsigned long flags;
+	struct stk11xx_rec_header header;
+	struct stk11xx_rec_start start;
+
+	if (likely(!READ_ONCE(dev->rec_mode)))
+		return;
+
+	memset(&header, 0, sizeof(header));
+	memset(&start, 0, sizeof(start));
+
+	start.model = dev->webcam_model;
+	start.resolution = dev->resolution;
+	start.width = stk11xx_image_sizes[dev->resolution].x;
+	start.height = stk11xx_image_sizes[dev->resolution].y;
+	start.frame_size = dev->frame_size;
+	start.speed = dev->speed;
+	start.packet_size = dev->isoc_in_size;
+
+	header.magic = STK11XX_RECORD_MAGIC;
+	header.type = STK11XX_RECORD_START;
+	header.size = sizeof(header) + sizeof(start);
+	header.timestamp = ktime_get_ns();
+
+	spin_lock_irqsave(&dev->rec_lock, flags);
+
+	if (dev->rec_mode && (kfifo_avail(&dev->rec_fifo) >= header.size)) {
+		header.mode = dev->rec_mode;
+
+		kfifo_in(&dev->rec_fifo, &header, sizeof(header));
+		kfifo_in(&dev->rec_fifo, &start, sizeof(start));
+	}
+
+	spin_unlock_irqrestore(&dev->rec_lock, flags);
+
+	wake_up_interruptible(&dev->rec_wait);
+}
+
+
+/**
+ * @param dev Device structure
+ * @param urb Completed isoc URB
+ *
+ * @brief Record an isoc URB.
+ *
+ * Called by the completion handler : it never waits. When the ring is full,
+ * the URB isn't recorded and it's counted as lost.
+ */
+void stk11xx_record_urb(struct usb_stk11xx *dev, struct urb *urb)
+{
+	int i;
+	unsigned int size;
+	unsigned long flags;
+
+	struct stk11xx_rec_header header;
+	struct stk11xx_rec_packet packet;
+	struct usb_iso_packet_descriptor *desc;
+
+	if (likely(!READ_ONCE(dev->rec_mode)))
+		return;
+
+	spin_lock_irqsave(&dev->rec_lock, flags);
+
+	if (!dev->rec_mode)
+		goto out;
+
+	size = sizeof(header) + urb->number_of_packets * sizeof(packet);
+
+	for (i=0; i<urb->number_of_packets; i++)
+		size += stk11xx_record_bytes(dev, &urb->iso_frame_desc[i]);
+
+	if (kfifo_avail(&dev->rec_fifo) < size) {
+		dev->rec_lost++;
+		goto out;
+	}
+
+	memset(&header, 0, sizeof(header));
+
+	header.magic = STK11XX_RECORD_MAGIC;
+	header.type = STK11XX_RECORD_URB;
+	header.mode = dev->rec_mode;
+	header.size = size;
+	header.count = urb->number_of_packets;
+	header.status = urb->status;
+	header.timestamp = ktime_get_ns();
+
+	kfifo_in(&dev->rec_fifo, &header, sizeof(header));
+
+	for (i=0; i<urb->number_of_packets; i++) {
+		desc = &urb->iso_frame_desc[i];
+
+		packet.status = desc->status;
+		packet.length = desc->actual_length;
+		packet.recorded = stk11xx_record_bytes(dev, desc);
+
+		kfifo_in(&dev->rec_fifo, &packet, sizeof(packet));
+	}
+
+	for (i=0; i<urb->number_of_packets; i++) {
+		desc = &urb->iso_frame_desc[i];
+
+		kfifo_in(&dev->rec_fifo, urb->transfer_buffer + desc->offset,
+				stk11xx_record_bytes(dev, desc));
+	}
+
+	dev->rec_urbs++;
+
+out:
+	spin_unlock_irqrestore(&dev->rec_lock, flags);
+
+	wake_up_interruptible(&dev->rec_wait);
+}
+
+
+/**
+ * @brief Read the mode of the recorder
+ */
+static ssize_t stk11xx_record_control_read(struct file *fp, char __user *buf, size_t count, loff_t *ppos)
+{
+	int len;
+	char str[16];
+	struct usb_stk11xx *dev = fp->private_data;
+
+	len = snprintf(str, sizeof(str), "%d\n", dev->rec_mode);
+
+	return simple_read_from_buffer(buf, count, ppos, str, len);
+}
+
+
+/**
+ * @brief Change the mode of the recorder : 0 off, 1 headers, 2 payloads
+ */
+static ssize_t stk11xx_record_control_write(struct file *fp, const char __user *buf, size_t count, loff_t *ppos)
+{
+	int err;
+	int mode;
+	struct usb_stk11xx *dev = fp->private_data;
+
+	err = kstrtoint_from_user(buf, count, 10, &mode);
+
+	if (err)
+		return err;
+
+	err = stk11xx_record_mode(dev, mode);
+
+	if (err)
+		return err;
+
+	return count;
+}
+
+
+/**
+ * @brief Read the records
+ *
+ * The reader waits for the records, and gets the end of the stream when the
+ * recorder is stopped.
+ */
+static ssize_t stk11xx_record_stream_read(struct file *fp, char __user *buf, size_t count, loff_t *ppos)
+{
+	int err;
+	unsigned int copied;
+	struct usb_stk11xx *dev = fp->private_data;
+
+	while (1) {
+		mutex_lock(&dev->rec_mutex);
+
+		if (dev->rec_buffer == NULL) {
+			mutex_unlock(&dev->rec_mutex);
+			return 0;
+		}
+
+		if (!kfifo_is_empty(&dev->rec_fifo)) {
+			err = kfifo_to_user(&dev->rec_fifo, buf, count, &copied);
+			mutex_unlock(&dev->rec_mutex);
+
+			return err ? err : copied;
+		}
+
+		mutex_unlock(&dev->rec_mutex);
+
+		if (fp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		err = wait_event_interruptible(dev->rec_wait,
+				!READ_ONCE(dev->rec_mode) || !kfifo_is_empty(&dev->rec_fifo));
+
+		if (err)
+			return err;
+	}
+}
+
+
+/**
+ * @var stk11xx_record_control_fops
+ */
+static const struct file_operations stk11xx_record_control_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = stk11xx_record_control_read,
+	.write = stk11xx_record_control_write,
+	.llseek = default_llseek,
+};
+
+
+/**
+ * @var stk11xx_record_stream_fops
+ */
+static const struct file_operations stk11xx_record_stream_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = stk11xx_record_stream_read,
+};
+
+
+/**
+ * @param dev Device structure
+ *
+ * @brief Create the entries of the device in the debugfs.
+ *
+ * In the directory of the device (named from its USB port, or from its
+ * platform device for a virtual camera) :
+ *   - record : mode of the isoc recorder (0 off, 1 headers, 2 payloads)
+ *   - record_stream : the records, as a binary stream
+ *   - record_urbs, record_lost : URBs recorded and lost
+ */
+void stk11xx_create_debugfs(struct usb_stk11xx *dev)
+{
+	dev->rec_mode = STK11XX_RECORD_OFF;
+	dev->rec_buffer = NULL;
+
+	spin_lock_init(&dev->rec_lock);
+	mutex_init(&dev->rec_mutex);
+	init_waitqueue_head(&dev->rec_wait);
+
+	if (IS_ERR_OR_NULL(stk11xx_debugfs_root))
+		return;
+
+	// A virtual camera is named from its platform device
+	dev->debugfs = debugfs_create_dir(dev_name((dev->udev != NULL) ? &dev->udev->dev : dev->parent),
+			stk11xx_debugfs_root);
+
+	if (IS_ERR_OR_NULL(dev->debugfs))
+		return;
+
+	debugfs_create_file("record", 0600, dev->debugfs, dev, &stk11xx_record_control_fops);
+	debugfs_create_file("record_stream", 0400, dev->debugfs, dev, &stk11xx_record_stream_fops);
+	debugfs_create_u32("record_urbs", 0400, dev->debugfs, &dev->rec_urbs);
+	debugfs_create_u32("record_lost", 0400, dev->debugfs, &dev->rec_lost);
+}
+
+
+/**
+ * @param dev Device structure
+ *
+ * @brief Remove the entries of the device from the debugfs, and stop the recorder.
+ */
+void stk11xx_remove_debugfs(struct usb_stk11xx *dev)
+{
+	// The readers return, so the entries can be removed
+	stk11xx_record_mode(dev, STK11XX_RECORD_OFF);
+
+	debugfs_remove_recursive(dev->debugfs);
+	dev->debugfs = NULL;
+
+	// It may have been started again in the meantime
+	stk11xx_record_mode(dev, STK11XX_RECORD_OFF);
+}
+
+
+/**
+ * @brief Create the directory of the driver in the debugfs.
+ */
+void stk11xx_debugfs_init(void)
+{
+	stk11xx_debugfs_root = debugfs_create_dir("stk11xx", NULL);
+
+	if (!IS_ERR_OR_NULL(stk11xx_debugfs_root))
+		stk11xx_sim_create_debugfs(stk11xx_debugfs_root);
+}
+
+
+/**
+ * @brief Remove the directory of the driver from the debugfs.
+ */
+void stk11xx_debugfs_exit(void)
+{
+	debugfs_remove_recursive(stk11xx_debugfs_root);
+	stk11xx_debugfs_root = NULL;
+}
@@ -112,6 +112,7 @@ int dev_stk0408_initialize_device(struct usb_stk11xx *dev)
 	dev_stk0408_configure_device(dev,2);
 	
 	usb_stk11xx_write_registry(dev, 0x0500, 0x0094); 
+	usb_stk11xx_wait_registry(dev);
 	msleep(10);
 	
 	dev_stk0408_camera_asleep(dev);
@@ -862,6 +863,7 @@ int dev_stk0408_stop_stream(struct usb_stk11xx *dev)
 	usb_stk11xx_read_registry(dev, 0x0100, &value);
 	value &= 0x7f;
 	usb_stk11xx_write_registry(dev, 0x0100, value);
+	usb_stk11xx_wait_registry(dev);
 	msleep(5);
 	
 	return 0;
@@ -1109,10 +1111,7 @@ int dev_stk0408_decode(struct usb_stk11xx *dev)
 	if (framebuf == NULL)
 		return -EFAULT;
 	
-	image  = dev->image_data;
-	STK_DEBUG("fill image %d\n", dev->fill_image);
-	
-	image += dev->images[dev->fill_image].offset;
+	image = dev->read_image;
 
 	data = framebuf->data;
 	odd = framebuf->odd;
@@ -139,6 +139,358 @@ int dev_stk6a31_initialize_device(struct usb_stk11xx *dev)
 }
 
 
+static const unsigned char stk6a31_config_values[][10] = {
+	//  001B,  001C,  0202,  0110,  0112,  0114,  0115,  0116,  0117,  0100
+	{ 0x03, 0x02, 0x0a, 0x00, 0x00, 0x80, 0x02, 0xe0, 0x01, 0x21 },	// 0
+	{ 0x0e, 0x46, 0x1e, 0x00, 0x00, 0x80, 0x02, 0xe0, 0x01, 0x21 },	// 1
+	{ 0x0e, 0x46, 0x1e, 0x00, 0x00, 0x80, 0x02, 0xe0, 0x01, 0x21 },	// 2
+	{ 0x0e, 0x46, 0x1e, 0x00, 0x00, 0x80, 0x02, 0xe0, 0x01, 0x21 },	// 3
+	{ 0x0e, 0x46, 0x1e, 0x00, 0x00, 0x00, 0x05, 0xe0, 0x01, 0x21 },	// 4
+	{ 0x0e, 0x46, 0x1e, 0x3e, 0x09, 0xbe, 0x02, 0xe9, 0x01, 0x21 },	// 5
+	{ 0x0e, 0x46, 0x1e, 0x00, 0x00, 0x80, 0x02, 0xe0, 0x01, 0x21 },	// 6
+	{ 0x0e, 0x46, 0x1e, 0x00, 0x00, 0x80, 0x02, 0xe0, 0x01, 0x21 },	// 7
+	{ 0x0e, 0x46, 0x1e, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x21 },	// 8
+	{ 0x07, 0x06, 0x1e, 0x00, 0x00, 0x80, 0x02, 0xe0, 0x01, 0x20 },	// 9
+	{ 0x07, 0x06, 0x1e, 0x00, 0x00, 0x80, 0x02, 0xe0, 0x01, 0x20 },	// 10
+	{ 0x07, 0x06, 0x0a, 0x00, 0x00, 0x80, 0x02, 0xe0, 0x01, 0x20 },	// 11
+	{ 0x07, 0x06, 0x1e, 0x00, 0x00, 0x00, 0x05, 0xe0, 0x01, 0x20 },	// 12
+	{ 0x07, 0x06, 0x1f, 0x00, 0x00, 0x80, 0x02, 0xe0, 0x01, 0x20 },	// 13
+	{ 0x07, 0x06, 0x1f, 0x00, 0x00, 0x80, 0x02, 0xe0, 0x01, 0x20 },	// 14
+	{ 0x07, 0x06, 0x1f, 0x00, 0x00, 0x80, 0x02, 0xe0, 0x01, 0x20 },	// 15
+	{ 0x07, 0x06, 0x1f, 0x00, 0x00, 0x80, 0x02, 0xe0, 0x01, 0x20 },	// 16
+};
+
+static const struct stk11xx_reg_op stk6a31_config_head[] = {
+	STK11XX_REG_WRITE(0x0000, 0x0024),
+	STK11XX_REG_WRITE(0x0002, 0x0078),
+	STK11XX_REG_WRITE(0x0003, 0x0080),
+	STK11XX_REG_WRITE(0x0005, 0x0000),
+
+	STK11XX_REG_WRITE(0x0007, 0x0003),
+	STK11XX_REG_WRITE(0x000d, 0x0000),
+	STK11XX_REG_WRITE(0x000f, 0x0002),
+	STK11XX_REG_WRITE(0x0300, 0x0012),
+	STK11XX_REG_WRITE(0x0350, 0x0041),
+
+	STK11XX_REG_WRITE(0x0351, 0x0000),
+	STK11XX_REG_WRITE(0x0352, 0x0000),
+	STK11XX_REG_WRITE(0x0353, 0x0000),
+	STK11XX_REG_WRITE(0x0018, 0x0010),
+	STK11XX_REG_WRITE(0x0019, 0x0000),
+
+	STK11XX_REG_STEP(0x001b, 0),
+	STK11XX_REG_STEP(0x001c, 1),
+	STK11XX_REG_WRITE(0x0300, 0x0080),
+	STK11XX_REG_WRITE(0x001a, 0x0004),
+	STK11XX_REG_STEP(0x0202, 2),
+
+	STK11XX_REG_STEP(0x0110, 3),
+	STK11XX_REG_WRITE(0x0111, 0x0000),
+	STK11XX_REG_STEP(0x0112, 4),
+	STK11XX_REG_WRITE(0x0113, 0x0000),
+	STK11XX_REG_STEP(0x0114, 5),
+
+	STK11XX_REG_STEP(0x0115, 6),
+	STK11XX_REG_STEP(0x0116, 7),
+	STK11XX_REG_STEP(0x0117, 8),
+
+	STK11XX_REG_READ(0x0100),
+	STK11XX_REG_STEP(0x0100, 9),
+
+//	STK11XX_REG_WRITE(0x0200, 0x0080),
+//	STK11XX_REG_WRITE(0x0200, 0x0000),
+	STK11XX_REG_WRITE(0x02ff, 0x0000),
+	STK11XX_REG_END
+};
+
+static const struct stk11xx_reg_op stk6a31_config_0[] = {
+	STK11XX_REG_WRITE(0x0203, 0x0022),
+
+	STK11XX_REG_SENSOR(0x0027, 0x00a5),
+
+	STK11XX_REG_WRITE(0x0200, 0x0005),
+	STK11XX_REG_END
+};
+
+static const struct stk11xx_reg_op stk6a31_config_1[] = {
+	STK11XX_REG_WRITE(0x0203, 0x0060),
+
+	STK11XX_REG_SENSOR(0x0012, 0x0080),
+	STK11XX_REG_SENSOR(0x0013, 0x00bf),
+
+	STK11XX_REG_WRITE(0x0200, 0x0005),
+	STK11XX_REG_END
+};
+
+static const struct stk11xx_reg_op stk6a31_config_2[] = {
+	STK11XX_REG_WRITE(0x0203, 0x0042),
+
+	STK11XX_REG_SENSOR(0x0012, 0x0080),
+	STK11XX_REG_SENSOR(0x0024, 0x00a5),
+
+	STK11XX_REG_WRITE(0x0200, 0x0005),
+	STK11XX_REG_END
+};
+
+static const struct stk11xx_reg_op stk6a31_config_3[] = {
+	STK11XX_REG_WRITE(0x0203, 0x0042),
+
+	STK11XX_REG_SENSOR(0x0012, 0x0080),
+	STK11XX_REG_SENSOR(0x0013, 0x00e0),
+	STK11XX_REG_SENSOR(0x0024, 0x00a5),
+
+	STK11XX_REG_WRITE(0x0200, 0x0005),
+	STK11XX_REG_END
+};
+
+static const struct stk11xx_reg_op stk6a31_config_4[] = {
+	STK11XX_REG_WRITE(0x0203, 0x0042),
+
+	STK11XX_REG_SENSOR(0x0012, 0x0080),
+	STK11XX_REG_SENSOR(0x0013, 0x00bf),
+
+	STK11XX_REG_WRITE(0x0200, 0x0005),
+	STK11XX_REG_END
+};
+
+static const struct stk11xx_reg_op stk6a31_config_5[] = {
+	STK11XX_REG_WRITE(0x0203, 0x0060),
+
+	STK11XX_REG_SENSOR(0x0012, 0x0080),
+	STK11XX_REG_SENSOR(0x0013, 0x00ff),
+
+	STK11XX_REG_WRITE(0x0200, 0x0005),
+	STK11XX_REG_END
+};
+
+static const struct stk11xx_reg_op stk6a31_config_6[] = {
+	STK11XX_REG_WRITE(0x0203, 0x0060),
+
+	STK11XX_REG_SENSOR(0x0012, 0x0080),
+	STK11XX_REG_SENSOR(0x0013, 0x00b7),
+
+	STK11XX_REG_WRITE(0x0200, 0x0005),
+	STK11XX_REG_END
+};
+
+static const struct stk11xx_reg_op stk6a31_config_7[] = {
+	STK11XX_REG_WRITE(0x0203, 0x0060),
+
+	STK11XX_REG_SENSOR(0x0012, 0x0080),
+	STK11XX_REG_SENSOR(0x0013, 0x00b7),
+
+	STK11XX_REG_WRITE(0x0200, 0x0005),
+	STK11XX_REG_END
+};
+
+static const struct stk11xx_reg_op stk6a31_config_8[] = {
+	STK11XX_REG_WRITE(0x0203, 0x0060),
+
+	STK11XX_REG_READ(0x02ff),
+	STK11XX_REG_WRITE(0x02ff, 0x0000),
+
+	STK11XX_REG_WRITE(0x0203, 0x0060),
+	STK11XX_REG_SENSOR(0x00ff, 0x0001),
+	STK11XX_REG_WRITE(0x0200, 0x0001),
+	STK11XX_REG_CHECK(500),
+	STK11XX_REG_WRITE(0x02ff, 0x0000),
+	STK11XX_REG_READ(0x02ff),
+	STK11XX_REG_WRITE(0x02ff, 0x0000),
+
+	STK11XX_REG_WRITE(0x0203, 0x0060),
+	STK11XX_REG_WRITE(0x0208, 0x000a),
+	STK11XX_REG_WRITE(0x0200, 0x0020),
+	STK11XX_REG_CHECK(500),
+	STK11XX_REG_READ(0x0209),
+	STK11XX_REG_WRITE(0x02ff, 0x0000),
+	STK11XX_REG_READ(0x02ff),
+	STK11XX_REG_WRITE(0x02ff, 0x0000),
+
+	STK11XX_REG_WRITE(0x0203, 0x0060),
+	STK11XX_REG_WRITE(0x0208, 0x000b),
+	STK11XX_REG_WRITE(0x0200, 0x0020),
+	STK11XX_REG_CHECK(500),
+	STK11XX_REG_READ(0x0209),
+	STK11XX_REG_WRITE(0x02ff, 0x0000),
+	STK11XX_REG_READ(0x02ff),
+	STK11XX_REG_WRITE(0x02ff, 0x0000),
+
+	STK11XX_REG_WRITE(0x0203, 0x0060),
+	STK11XX_REG_WRITE(0x0208, 0x001c),
+	STK11XX_REG_WRITE(0x0200, 0x0020),
+	STK11XX_REG_CHECK(500),
+	STK11XX_REG_READ(0x0209),
+	STK11XX_REG_WRITE(0x02ff, 0x0000),
+	STK11XX_REG_READ(0x02ff),
+	STK11XX_REG_WRITE(0x02ff, 0x0000),
+
+	STK11XX_REG_WRITE(0x0203, 0x0060),
+	STK11XX_REG_WRITE(0x0208, 0x001d),
+	STK11XX_REG_WRITE(0x0200, 0x0020),
+	STK11XX_REG_CHECK(500),
+	STK11XX_REG_READ(0x0209),
+	STK11XX_REG_WRITE(0x02ff, 0x0000),
+	STK11XX_REG_END
+};
+
+static const struct stk11xx_reg_op stk6a31_config_9[] = {
+	STK11XX_REG_WRITE(0x0203, 0x00dc),
+
+	STK11XX_REG_SENSOR(0x0015, 0x0080),
+
+	STK11XX_REG_WRITE(0x0200, 0x0005),
+	STK11XX_REG_END
+};
+
+static const struct stk11xx_reg_op stk6a31_config_10[] = {
+	STK11XX_REG_WRITE(0x0203, 0x00ec),
+
+	STK11XX_REG_SENSOR(0x0015, 0x0080),
+
+	STK11XX_REG_WRITE(0x0200, 0x0005),
+	STK11XX_REG_END
+};
+
+static const struct stk11xx_reg_op stk6a31_config_11[] = {
+	STK11XX_REG_WRITE(0x0203, 0x00ba),
+
+	STK11XX_REG_READ(0x02ff),
+	STK11XX_REG_WRITE(0x02ff, 0x0000),
+
+	STK11XX_REG_WRITE(0x0203, 0x00ba),
+
+	STK11XX_REG_WRITE(0x0208, 0x0000),
+	STK11XX_REG_WRITE(0x0200, 0x0020),
+	STK11XX_REG_CHECK(500),
+	STK11XX_REG_READ(0x0209),
+	STK11XX_REG_WRITE(0x02ff, 0x0000),
+	STK11XX_REG_END
+};
+
+static const struct stk11xx_reg_op stk6a31_config_12[] = {
+	STK11XX_REG_WRITE(0x0203, 0x00ba),
+
+	STK11XX_REG_SENSOR(0x00f0, 0x0000),
+	STK11XX_REG_WRITE(0x0200, 0x0005),
+	STK11XX_REG_CHECK(500),
+	STK11XX_REG_SENSOR(0x00f1, 0x0000),
+	STK11XX_REG_WRITE(0x0200, 0x0005),
+	STK11XX_REG_CHECK(500),
+	STK11XX_REG_READ(0x02ff),
+	STK11XX_REG_WRITE(0x02ff, 0x0000),
+
+	STK11XX_REG_WRITE(0x0203, 0x00ba),
+	STK11XX_REG_WRITE(0x0208, 0x0000),
+	STK11XX_REG_WRITE(0x0200, 0x0020),
+	STK11XX_REG_CHECK(500),
+	STK11XX_REG_READ(0x0209),
+	STK11XX_REG_WRITE(0x02ff, 0x0000),
+	STK11XX_REG_READ(0x02ff),
+	STK11XX_REG_WRITE(0x02ff, 0x0000),
+
+	STK11XX_REG_WRITE(0x0203, 0x00ba),
+	STK11XX_REG_WRITE(0x0208, 0x00f1),
+	STK11XX_REG_WRITE(0x0200, 0x0020),
+	STK11XX_REG_CHECK(500),
+	STK11XX_REG_READ(0x0209),
+	STK11XX_REG_WRITE(0x02ff, 0x0000),
+	STK11XX_REG_END
+};
+
+static const struct stk11xx_reg_op stk6a31_config_13[] = {
+	STK11XX_REG_WRITE(0x0203, 0x00ba),
+
+	STK11XX_REG_READ(0x02ff),
+	STK11XX_REG_WRITE(0x02ff, 0x0000),
+
+	STK11XX_REG_WRITE(0x0203, 0x00ba),
+	STK11XX_REG_WRITE(0x0208, 0x0000),
+	STK11XX_REG_WRITE(0x0200, 0x0020),
+	STK11XX_REG_CHECK(500),
+	STK11XX_REG_READ(0x0209),
+	STK11XX_REG_WRITE(0x02ff, 0x0000),
+	STK11XX_REG_READ(0x02ff),
+	STK11XX_REG_WRITE(0x02ff, 0x0000),
+
+	STK11XX_REG_WRITE(0x0203, 0x00ba),
+	STK11XX_REG_WRITE(0x0208, 0x00f1),
+	STK11XX_REG_WRITE(0x0200, 0x0020),
+	STK11XX_REG_CHECK(500),
+	STK11XX_REG_READ(0x0209),
+	STK11XX_REG_WRITE(0x02ff, 0x0000),
+	STK11XX_REG_END
+};
+
+static const struct stk11xx_reg_op stk6a31_config_14[] = {
+	STK11XX_REG_WRITE(0x0203, 0x00ba),
+
+	STK11XX_REG_SENSOR(0x0001, 0x0000),
+	STK11XX_REG_WRITE(0x0200, 0x0005),
+	STK11XX_REG_CHECK(500),
+	STK11XX_REG_SENSOR(0x00f1, 0x0000),
+	STK11XX_REG_WRITE(0x0200, 0x0005),
+	STK11XX_REG_CHECK(500),
+	STK11XX_REG_READ(0x02ff),
+	STK11XX_REG_WRITE(0x02ff, 0x0000),
+
+	STK11XX_REG_WRITE(0x0203, 0x00ba),
+	STK11XX_REG_WRITE(0x0208, 0x0000),
+	STK11XX_REG_WRITE(0x0200, 0x0020),
+	STK11XX_REG_CHECK(500),
+	STK11XX_REG_READ(0x0209),
+	STK11XX_REG_WRITE(0x02ff, 0x0000),
+	STK11XX_REG_READ(0x02ff),
+	STK11XX_REG_WRITE(0x02ff, 0x0000),
+
+	STK11XX_REG_WRITE(0x0203, 0x00ba),
+	STK11XX_REG_WRITE(0x0208, 0x00f1),
+	STK11XX_REG_WRITE(0x0200, 0x0020),
+	STK11XX_REG_CHECK(500),
+	STK11XX_REG_READ(0x0209),
+	STK11XX_REG_WRITE(0x02ff, 0x0000),
+	STK11XX_REG_END
+};
+
+static const struct stk11xx_reg_op stk6a31_config_15[] = {
+	STK11XX_REG_WRITE(0x0203, 0x00ba),
+
+	STK11XX_REG_HOOK,
+
+	STK11XX_REG_WRITE(0x0200, 0x0080),
+	STK11XX_REG_WRITE(0x0200, 0x0000),
+	STK11XX_REG_WRITE(0x02ff, 0x0001),
+	STK11XX_REG_WRITE(0x0203, 0x00a0),
+	STK11XX_REG_END
+};
+
+static const struct stk11xx_reg_op stk6a31_config_16[] = {
+	STK11XX_REG_WRITE(0x0203, 0x00ba),
+
+	STK11XX_REG_HOOK,
+	STK11XX_REG_END
+};
+
+static const struct stk11xx_reg_op * const stk6a31_config_steps[] = {
+	stk6a31_config_0,
+	stk6a31_config_1,
+	stk6a31_config_2,
+	stk6a31_config_3,
+	stk6a31_config_4,
+	stk6a31_config_5,
+	stk6a31_config_6,
+	stk6a31_config_7,
+	stk6a31_config_8,
+	stk6a31_config_9,
+	stk6a31_config_10,
+	stk6a31_config_11,
+	stk6a31_config_12,
+	stk6a31_config_13,
+	stk6a31_config_14,
+	stk6a31_config_15,
+	stk6a31_config_16,
+};
+
+
 /** 
  * @param dev Device structure
  * @param step The step of configuration [0-11]
@@ -154,378 +506,13 @@ int dev_stk6a31_initialize_device(struct usb_stk11xx *dev)
  */
 int dev_stk6a31_configure_device(struct usb_stk11xx *dev, int step)
 {
-	int retok;
-	int value;
-
-	//     0,    1,    2,    3,    4,    5,    6,    7,    8,    9,   10,   11,   12,   13,   14,   15,   16
-	static const int values_001B[] = {
-		0x03, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07
-	};
-	static const int values_001C[] = {
-		0x02, 0x46, 0x46, 0x46, 0x46, 0x46, 0x46, 0x46, 0x46, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06
-	};
-	static const int values_0202[] = {
-		0x0a, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x0a, 0x1e, 0x1f, 0x1f, 0x1f, 0x1f
-	};
-	static const int values_0110[] = {
-		0x00, 0x00, 0x00, 0x00, 0x00, 0x3e, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
-	};
-	static const int values_0112[] = {
-		0x00, 0x00, 0x00, 0x00, 0x00, 0x09, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
-	};
-	static const int values_0114[] = {
-		0x80, 0x80, 0x80, 0x80, 0x00, 0xbe, 0x80, 0x80, 0x00, 0x80, 0x80, 0x80, 0x00, 0x80, 0x80, 0x80, 0x80
-	};
-	static const int values_0115[] = {
-		0x02, 0x02, 0x02, 0x02, 0x05, 0x02, 0x02, 0x02, 0x00, 0x02, 0x02, 0x02, 0x05, 0x02, 0x02, 0x02, 0x02
-	};
-	static const int values_0116[] = {
-		0xe0, 0xe0, 0xe0, 0xe0, 0xe0, 0xe9, 0xe0, 0xe0, 0x00, 0xe0, 0xe0, 0xe0, 0xe0, 0xe0, 0xe0, 0xe0, 0xe0
-	};
-	static const int values_0117[] = {
-		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01
-	};
-	static const int values_0100[] = {
-		0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20
-	};
-
-
 	STK_DEBUG("dev_stk6a31_configure_device : %d\n", step);
 
-	usb_stk11xx_write_registry(dev, 0x0000, 0x0024);
-	usb_stk11xx_write_registry(dev, 0x0002, 0x0078);
-	usb_stk11xx_write_registry(dev, 0x0003, 0x0080);
-	usb_stk11xx_write_registry(dev, 0x0005, 0x0000);
-	
-	usb_stk11xx_write_registry(dev, 0x0007, 0x0003);
-	usb_stk11xx_write_registry(dev, 0x000d, 0x0000);
-	usb_stk11xx_write_registry(dev, 0x000f, 0x0002);
-	usb_stk11xx_write_registry(dev, 0x0300, 0x0012);
-	usb_stk11xx_write_registry(dev, 0x0350, 0x0041);
-	
-	usb_stk11xx_write_registry(dev, 0x0351, 0x0000);
-	usb_stk11xx_write_registry(dev, 0x0352, 0x0000);
-	usb_stk11xx_write_registry(dev, 0x0353, 0x0000);
-	usb_stk11xx_write_registry(dev, 0x0018, 0x0010);
-	usb_stk11xx_write_registry(dev, 0x0019, 0x0000);
-	
-	usb_stk11xx_write_registry(dev, 0x001b, values_001B[step]);
-	usb_stk11xx_write_registry(dev, 0x001c, values_001C[step]);
-	usb_stk11xx_write_registry(dev, 0x0300, 0x0080);
-	usb_stk11xx_write_registry(dev, 0x001a, 0x0004);
-	usb_stk11xx_write_registry(dev, 0x0202, values_0202[step]);
-	
-	usb_stk11xx_write_registry(dev, 0x0110, values_0110[step]);
-	usb_stk11xx_write_registry(dev, 0x0111, 0x0000);
-	usb_stk11xx_write_registry(dev, 0x0112, values_0112[step]);
-	usb_stk11xx_write_registry(dev, 0x0113, 0x0000);
-	usb_stk11xx_write_registry(dev, 0x0114, values_0114[step]);
-	
-	usb_stk11xx_write_registry(dev, 0x0115, values_0115[step]);
-	usb_stk11xx_write_registry(dev, 0x0116, values_0116[step]);
-	usb_stk11xx_write_registry(dev, 0x0117, values_0117[step]);
-
-	usb_stk11xx_read_registry(dev, 0x0100, &value);
-	usb_stk11xx_write_registry(dev, 0x0100, values_0100[step]);
-
-//	usb_stk11xx_write_registry(dev, 0x0200, 0x0080); 
-//	usb_stk11xx_write_registry(dev, 0x0200, 0x0000); 
-	usb_stk11xx_write_registry(dev, 0x02ff, 0x0000); 
-
-
-	switch (step) {
-		case 0:
-			usb_stk11xx_write_registry(dev, 0x0203, 0x0022); 
-
-			usb_stk11xx_write_registry(dev, 0x0204, 0x0027); 
-			usb_stk11xx_write_registry(dev, 0x0205, 0x00a5); 
+	dev_stk11xx_run_sequence(dev, stk6a31_config_head, stk6a31_config_values[step], NULL);
 
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0005); 
+	if (stk6a31_config_steps[step] != NULL)
+		dev_stk11xx_run_sequence(dev, stk6a31_config_steps[step], NULL, dev_stk6a31_sensor_settings);
 
-			break;
-	
-		case 1:
-			usb_stk11xx_write_registry(dev, 0x0203, 0x0060); 
-
-			usb_stk11xx_write_registry(dev, 0x0204, 0x0012); 
-			usb_stk11xx_write_registry(dev, 0x0205, 0x0080); 
-			usb_stk11xx_write_registry(dev, 0x0204, 0x0013); 
-			usb_stk11xx_write_registry(dev, 0x0205, 0x00bf); 
-
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0005); 
-
-			break;
-
-		case 2:
-			usb_stk11xx_write_registry(dev, 0x0203, 0x0042); 
-
-			usb_stk11xx_write_registry(dev, 0x0204, 0x0012); 
-			usb_stk11xx_write_registry(dev, 0x0205, 0x0080); 
-			usb_stk11xx_write_registry(dev, 0x0204, 0x0024); 
-			usb_stk11xx_write_registry(dev, 0x0205, 0x00a5); 
-
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0005); 
-
-			break;
-
-		case 3:
-			usb_stk11xx_write_registry(dev, 0x0203, 0x0042); 
-
-			usb_stk11xx_write_registry(dev, 0x0204, 0x0012); 
-			usb_stk11xx_write_registry(dev, 0x0205, 0x0080); 
-			usb_stk11xx_write_registry(dev, 0x0204, 0x0013); 
-			usb_stk11xx_write_registry(dev, 0x0205, 0x00e0); 
-			usb_stk11xx_write_registry(dev, 0x0204, 0x0024); 
-			usb_stk11xx_write_registry(dev, 0x0205, 0x00a5); 
-
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0005); 
-
-			break;
-
-		case 4:
-			usb_stk11xx_write_registry(dev, 0x0203, 0x0042); 
-
-			usb_stk11xx_write_registry(dev, 0x0204, 0x0012); 
-			usb_stk11xx_write_registry(dev, 0x0205, 0x0080); 
-			usb_stk11xx_write_registry(dev, 0x0204, 0x0013); 
-			usb_stk11xx_write_registry(dev, 0x0205, 0x00bf); 
-
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0005); 
-
-			break;
-
-		case 5:
-			usb_stk11xx_write_registry(dev, 0x0203, 0x0060); 
-
-			usb_stk11xx_write_registry(dev, 0x0204, 0x0012); 
-			usb_stk11xx_write_registry(dev, 0x0205, 0x0080); 
-			usb_stk11xx_write_registry(dev, 0x0204, 0x0013); 
-			usb_stk11xx_write_registry(dev, 0x0205, 0x00ff); 
-
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0005); 
-
-			break;
-
-		case 6:
-			usb_stk11xx_write_registry(dev, 0x0203, 0x0060); 
-
-			usb_stk11xx_write_registry(dev, 0x0204, 0x0012); 
-			usb_stk11xx_write_registry(dev, 0x0205, 0x0080); 
-			usb_stk11xx_write_registry(dev, 0x0204, 0x0013); 
-			usb_stk11xx_write_registry(dev, 0x0205, 0x00b7); 
-
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0005); 
-
-			break;
-
-		case 7:
-			usb_stk11xx_write_registry(dev, 0x0203, 0x0060); 
-
-			usb_stk11xx_write_registry(dev, 0x0204, 0x0012); 
-			usb_stk11xx_write_registry(dev, 0x0205, 0x0080); 
-			usb_stk11xx_write_registry(dev, 0x0204, 0x0013); 
-			usb_stk11xx_write_registry(dev, 0x0205, 0x00b7); 
-
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0005); 
-
-			break;
-
-		case 8:
-			usb_stk11xx_write_registry(dev, 0x0203, 0x0060); 
-
-			usb_stk11xx_read_registry(dev, 0x02ff, &value);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0000); 
-
-			usb_stk11xx_write_registry(dev, 0x0203, 0x0060); 
-			usb_stk11xx_write_registry(dev, 0x0204, 0x00ff); 
-			usb_stk11xx_write_registry(dev, 0x0205, 0x0001); 
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0001); 
-			retok = dev_stk11xx_check_device(dev, 500);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0000); 
-			usb_stk11xx_read_registry(dev, 0x02ff, &value);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0000); 
-
-			usb_stk11xx_write_registry(dev, 0x0203, 0x0060); 
-			usb_stk11xx_write_registry(dev, 0x0208, 0x000a); 
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0020); 
-			retok = dev_stk11xx_check_device(dev, 500);
-			usb_stk11xx_read_registry(dev, 0x0209, &value);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0000); 
-			usb_stk11xx_read_registry(dev, 0x02ff, &value);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0000); 
-
-			usb_stk11xx_write_registry(dev, 0x0203, 0x0060); 
-			usb_stk11xx_write_registry(dev, 0x0208, 0x000b); 
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0020); 
-			retok = dev_stk11xx_check_device(dev, 500);
-			usb_stk11xx_read_registry(dev, 0x0209, &value);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0000); 
-			usb_stk11xx_read_registry(dev, 0x02ff, &value);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0000); 
-
-			usb_stk11xx_write_registry(dev, 0x0203, 0x0060); 
-			usb_stk11xx_write_registry(dev, 0x0208, 0x001c); 
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0020); 
-			retok = dev_stk11xx_check_device(dev, 500);
-			usb_stk11xx_read_registry(dev, 0x0209, &value);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0000); 
-			usb_stk11xx_read_registry(dev, 0x02ff, &value);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0000); 
-
-			usb_stk11xx_write_registry(dev, 0x0203, 0x0060); 
-			usb_stk11xx_write_registry(dev, 0x0208, 0x001d); 
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0020); 
-			retok = dev_stk11xx_check_device(dev, 500);
-			usb_stk11xx_read_registry(dev, 0x0209, &value);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0000); 
-
-			break;
-
-		case 9:
-			usb_stk11xx_write_registry(dev, 0x0203, 0x00dc); 
-
-			usb_stk11xx_write_registry(dev, 0x0204, 0x0015); 
-			usb_stk11xx_write_registry(dev, 0x0205, 0x0080); 
-
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0005); 
-
-			break;
-
-		case 10:
-			usb_stk11xx_write_registry(dev, 0x0203, 0x00ec); 
-
-			usb_stk11xx_write_registry(dev, 0x0204, 0x0015); 
-			usb_stk11xx_write_registry(dev, 0x0205, 0x0080); 
-
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0005); 
-
-			break;
-
-		case 11:
-			usb_stk11xx_write_registry(dev, 0x0203, 0x00ba); 
-
-			usb_stk11xx_read_registry(dev, 0x02ff, &value);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0000);
-
-			usb_stk11xx_write_registry(dev, 0x0203, 0x00ba); 
-
-			usb_stk11xx_write_registry(dev, 0x0208, 0x0000);
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0020);
-			retok = dev_stk11xx_check_device(dev, 500);
-			usb_stk11xx_read_registry(dev, 0x0209, &value);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0000);
-
-			break;
-
-		case 12:
-			usb_stk11xx_write_registry(dev, 0x0203, 0x00ba); 
-
-			usb_stk11xx_write_registry(dev, 0x0204, 0x00f0); 
-			usb_stk11xx_write_registry(dev, 0x0205, 0x0000); 
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0005);
-			retok = dev_stk11xx_check_device(dev, 500);
-			usb_stk11xx_write_registry(dev, 0x0204, 0x00f1); 
-			usb_stk11xx_write_registry(dev, 0x0205, 0x0000); 
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0005);
-			retok = dev_stk11xx_check_device(dev, 500);
-			usb_stk11xx_read_registry(dev, 0x02ff, &value);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0000);
-
-			usb_stk11xx_write_registry(dev, 0x0203, 0x00ba); 
-			usb_stk11xx_write_registry(dev, 0x0208, 0x0000);
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0020);
-			retok = dev_stk11xx_check_device(dev, 500);
-			usb_stk11xx_read_registry(dev, 0x0209, &value);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0000);
-			usb_stk11xx_read_registry(dev, 0x02ff, &value);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0000);
-
-			usb_stk11xx_write_registry(dev, 0x0203, 0x00ba); 
-			usb_stk11xx_write_registry(dev, 0x0208, 0x00f1);
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0020);
-			retok = dev_stk11xx_check_device(dev, 500);
-			usb_stk11xx_read_registry(dev, 0x0209, &value);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0000);
-
-			break;
-
-		case 13:
-			usb_stk11xx_write_registry(dev, 0x0203, 0x00ba); 
-
-			usb_stk11xx_read_registry(dev, 0x02ff, &value);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0000);
-
-			usb_stk11xx_write_registry(dev, 0x0203, 0x00ba); 
-			usb_stk11xx_write_registry(dev, 0x0208, 0x0000);
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0020);
-			retok = dev_stk11xx_check_device(dev, 500);
-			usb_stk11xx_read_registry(dev, 0x0209, &value);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0000);
-			usb_stk11xx_read_registry(dev, 0x02ff, &value);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0000);
-
-			usb_stk11xx_write_registry(dev, 0x0203, 0x00ba); 
-			usb_stk11xx_write_registry(dev, 0x0208, 0x00f1);
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0020);
-			retok = dev_stk11xx_check_device(dev, 500);
-			usb_stk11xx_read_registry(dev, 0x0209, &value);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0000);
-
-			break;
-
-		case 14:
-			usb_stk11xx_write_registry(dev, 0x0203, 0x00ba); 
-
-			usb_stk11xx_write_registry(dev, 0x0204, 0x0001); 
-			usb_stk11xx_write_registry(dev, 0x0205, 0x0000); 
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0005); 
-			retok = dev_stk11xx_check_device(dev, 500);
-			usb_stk11xx_write_registry(dev, 0x0204, 0x00f1); 
-			usb_stk11xx_write_registry(dev, 0x0205, 0x0000); 
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0005); 
-			retok = dev_stk11xx_check_device(dev, 500);
-			usb_stk11xx_read_registry(dev, 0x02ff, &value);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0000);
-
-			usb_stk11xx_write_registry(dev, 0x0203, 0x00ba); 
-			usb_stk11xx_write_registry(dev, 0x0208, 0x0000);
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0020);
-			retok = dev_stk11xx_check_device(dev, 500);
-			usb_stk11xx_read_registry(dev, 0x0209, &value);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0000);
-			usb_stk11xx_read_registry(dev, 0x02ff, &value);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0000);
-
-			usb_stk11xx_write_registry(dev, 0x0203, 0x00ba); 
-			usb_stk11xx_write_registry(dev, 0x0208, 0x00f1);
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0020);
-			retok = dev_stk11xx_check_device(dev, 500);
-			usb_stk11xx_read_registry(dev, 0x0209, &value);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0000);
-
-			break;
-
-		case 15:
-			usb_stk11xx_write_registry(dev, 0x0203, 0x00ba); 
-
-			dev_stk6a31_sensor_settings(dev);
-
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0080);
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0000);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0001);
-			usb_stk11xx_write_registry(dev, 0x0203, 0x00a0);
-
-
-			break;
-
-		case 16:
-			usb_stk11xx_write_registry(dev, 0x0203, 0x00ba); 
-
-			dev_stk6a31_sensor_settings(dev);
-
-			break;
-	}
-	
 	return 0;
 }
 
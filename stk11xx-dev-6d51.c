@@ -116,6 +116,84 @@ int dev_stk6d51_initialize_device(struct usb_stk11xx *dev)
 }
 
 
+static const unsigned char stk6d51_config_values[][10] = {
+	//  001B,  001C,  0202,  0110,  0112,  0114,  0115,  0116,  0117,  0100
+	{ 0x0e, 0x46, 0x0a, 0x00, 0x01, 0x80, 0x02, 0xe1, 0x01, 0x20 },	// 0
+	{ 0x0e, 0x46, 0x0a, 0x00, 0x01, 0x80, 0x02, 0xe1, 0x01, 0x20 },	// 1
+};
+
+static const struct stk11xx_reg_op stk6d51_config_head[] = {
+	STK11XX_REG_WRITE(0x0000, 0x0024),
+	STK11XX_REG_WRITE(0x0002, 0x0078),
+	STK11XX_REG_WRITE(0x0003, 0x0080),
+	STK11XX_REG_WRITE(0x0005, 0x0000),
+
+	STK11XX_REG_WRITE(0x0007, 0x0003),
+	STK11XX_REG_WRITE(0x000d, 0x0000),
+	STK11XX_REG_WRITE(0x000f, 0x0002),
+	STK11XX_REG_WRITE(0x0300, 0x0012),
+	STK11XX_REG_WRITE(0x0350, 0x0041),
+
+	STK11XX_REG_WRITE(0x0351, 0x0000),
+	STK11XX_REG_WRITE(0x0352, 0x0000),
+	STK11XX_REG_WRITE(0x0353, 0x0000),
+	STK11XX_REG_WRITE(0x0018, 0x0010),
+	STK11XX_REG_WRITE(0x0019, 0x0000),
+
+	STK11XX_REG_STEP(0x001b, 0),
+	STK11XX_REG_STEP(0x001c, 1),
+	STK11XX_REG_WRITE(0x0300, 0x0080),
+	STK11XX_REG_WRITE(0x001a, 0x0004),
+	STK11XX_REG_STEP(0x0202, 2),
+
+	STK11XX_REG_STEP(0x0110, 3),
+	STK11XX_REG_WRITE(0x0111, 0x0000),
+	STK11XX_REG_STEP(0x0112, 4),
+	STK11XX_REG_WRITE(0x0113, 0x0000),
+	STK11XX_REG_STEP(0x0114, 5),
+
+	STK11XX_REG_STEP(0x0115, 6),
+	STK11XX_REG_STEP(0x0116, 7),
+	STK11XX_REG_STEP(0x0117, 8),
+
+	STK11XX_REG_READ(0x0100),
+	STK11XX_REG_STEP(0x0100, 9),
+
+	STK11XX_REG_WRITE(0x02ff, 0x0001),
+	STK11XX_REG_END
+};
+
+static const struct stk11xx_reg_op stk6d51_config_0[] = {
+	STK11XX_REG_WRITE(0x0203, 0x007a),
+
+	STK11XX_REG_READ(0x02ff),
+	STK11XX_REG_WRITE(0x02ff, 0x0001),
+
+	STK11XX_REG_WRITE(0x0203, 0x007a),
+
+	STK11XX_REG_WRITE(0x0205, 0x0030),
+	STK11XX_REG_WRITE(0x0205, 0x0000),
+
+	STK11XX_REG_WRITE(0x0200, 0x0061),
+	STK11XX_REG_END
+};
+
+static const struct stk11xx_reg_op stk6d51_config_1[] = {
+	STK11XX_REG_WRITE(0x0203, 0x007a),
+
+	STK11XX_REG_HOOK,
+
+	STK11XX_REG_READ(0x0000),
+	STK11XX_REG_WRITE(0x0200, 0x0021),
+	STK11XX_REG_END
+};
+
+static const struct stk11xx_reg_op * const stk6d51_config_steps[] = {
+	stk6d51_config_0,
+	stk6d51_config_1,
+};
+
+
 /** 
  * @param dev Device structure
  * @param step The step of configuration [0-11]
@@ -131,108 +209,12 @@ int dev_stk6d51_initialize_device(struct usb_stk11xx *dev)
  */
 int dev_stk6d51_configure_device(struct usb_stk11xx *dev, int step)
 {
-	int value;
-
-	//     0,    1
-	static const int values_001B[] = {
-		0x0e, 0x0e
-	};
-	static const int values_001C[] = {
-		0x46, 0x46
-	};
-	static const int values_0202[] = {
-		0x0a, 0x0a
-	};
-	static const int values_0110[] = {
-		0x00, 0x00
-	};
-	static const int values_0112[] = {
-		0x01, 0x01
-	};
-	static const int values_0114[] = {
-		0x80, 0x80
-	};
-	static const int values_0115[] = {
-		0x02, 0x02
-	};
-	static const int values_0116[] = {
-		0xe1, 0xe1
-	};
-	static const int values_0117[] = {
-		0x01, 0x01
-	};
-	static const int values_0100[] = {
-		0x20, 0x20
-	};
-
-
 	STK_DEBUG("dev_stk6d51_configure_device : %d\n", step);
 
-	usb_stk11xx_write_registry(dev, 0x0000, 0x0024);
-	usb_stk11xx_write_registry(dev, 0x0002, 0x0078);
-	usb_stk11xx_write_registry(dev, 0x0003, 0x0080);
-	usb_stk11xx_write_registry(dev, 0x0005, 0x0000);
-	
-	usb_stk11xx_write_registry(dev, 0x0007, 0x0003);
-	usb_stk11xx_write_registry(dev, 0x000d, 0x0000);
-	usb_stk11xx_write_registry(dev, 0x000f, 0x0002);
-	usb_stk11xx_write_registry(dev, 0x0300, 0x0012);
-	usb_stk11xx_write_registry(dev, 0x0350, 0x0041);
-	
-	usb_stk11xx_write_registry(dev, 0x0351, 0x0000);
-	usb_stk11xx_write_registry(dev, 0x0352, 0x0000);
-	usb_stk11xx_write_registry(dev, 0x0353, 0x0000);
-	usb_stk11xx_write_registry(dev, 0x0018, 0x0010);
-	usb_stk11xx_write_registry(dev, 0x0019, 0x0000);
-	
-	usb_stk11xx_write_registry(dev, 0x001b, values_001B[step]);
-	usb_stk11xx_write_registry(dev, 0x001c, values_001C[step]);
-	usb_stk11xx_write_registry(dev, 0x0300, 0x0080);
-	usb_stk11xx_write_registry(dev, 0x001a, 0x0004);
-	usb_stk11xx_write_registry(dev, 0x0202, values_0202[step]);
-	
-	usb_stk11xx_write_registry(dev, 0x0110, values_0110[step]);
-	usb_stk11xx_write_registry(dev, 0x0111, 0x0000);
-	usb_stk11xx_write_registry(dev, 0x0112, values_0112[step]);
-	usb_stk11xx_write_registry(dev, 0x0113, 0x0000);
-	usb_stk11xx_write_registry(dev, 0x0114, values_0114[step]);
-	
-	usb_stk11xx_write_registry(dev, 0x0115, values_0115[step]);
-	usb_stk11xx_write_registry(dev, 0x0116, values_0116[step]);
-	usb_stk11xx_write_registry(dev, 0x0117, values_0117[step]);
-
-	usb_stk11xx_read_registry(dev, 0x0100, &value);
-	usb_stk11xx_write_registry(dev, 0x0100, values_0100[step]);
-
-	usb_stk11xx_write_registry(dev, 0x02ff, 0x0001); 
-
-
-	switch (step) {
-		case 0:
-			usb_stk11xx_write_registry(dev, 0x0203, 0x007a); 
-
-			usb_stk11xx_read_registry(dev, 0x02ff, &value);
-			usb_stk11xx_write_registry(dev, 0x02ff, 0x0001);
-
-			usb_stk11xx_write_registry(dev, 0x0203, 0x007a); 
-
-			usb_stk11xx_write_registry(dev, 0x0205, 0x0030); 
-			usb_stk11xx_write_registry(dev, 0x0205, 0x0000); 
-
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0061); 
-
-			break;
-	
-		case 1:
-			usb_stk11xx_write_registry(dev, 0x0203, 0x007a); 
-
-			dev_stk6d51_sensor_settings(dev);
-
-			usb_stk11xx_read_registry(dev, 0x0000, &value);
-			usb_stk11xx_write_registry(dev, 0x0200, 0x0021);
-
-			break;
-	}
+	dev_stk11xx_run_sequence(dev, stk6d51_config_head, stk6d51_config_values[step], NULL);
+
+	if (stk6d51_config_steps[step] != NULL)
+		dev_stk11xx_run_sequence(dev, stk6d51_config_steps[step], NULL, dev_stk6d51_sensor_settings);
 
 	return 0;
 }
@@ -38,6 +38,8 @@
 #include <linux/errno.h>
 #include <linux/slab.h>
 #include <linux/kref.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
 
 #include <linux/usb.h>
 #include <media/v4l2-common.h>
@@ -47,6 +49,30 @@
 #include "stk11xx-dev.h"
 
 
+/**
+ * @var stk11xx_frame_rates
+ *   Frame rates delivered by the driver, highest first. The rates under the one
+ *   of the sensor are obtained by skipping frames (see stk11xx_frame_wanted)
+ *
+ * @var stka311_vga_rates
+ *   Frame rates of the STK-A311 sensor in the 640x480 mode, highest first (see dev_stka311_set_camera_fps)
+ *
+ * @var stka311_sxga_rates
+ *   Frame rates of the STK-A311 sensor in the 1280x1024 mode, the isoc stream can't carry more
+ *
+ * @var stk11xx_ntsc_rates
+ *   Native frame rate of a NTSC source
+ *
+ * @var stk11xx_native_rates
+ *   Native frame rate of the sensors whose frame rate isn't programmed
+ */
+static const int stk11xx_frame_rates[] = { 30, 25, 20, 15, 10, 5 };
+static const int stka311_vga_rates[] = { 30, 25, 20, 15, 10 };
+static const int stka311_sxga_rates[] = { 15, 10 };
+static const int stk11xx_ntsc_rates[] = { 30 };
+static const int stk11xx_native_rates[] = { 25 };
+
+
 /** 
  * @param dev Device structure
  * 
@@ -63,6 +89,13 @@
 int dev_stk11xx_initialize_device(struct usb_stk11xx *dev)
 {
 	int ret;
+	int err;
+
+	// The device is reset by its initialization
+	usb_stk11xx_invalidate_registry(dev);
+
+	// The writes are only waited for at the reads of the sequence
+	usb_stk11xx_begin_registry(dev);
 
 	switch (dev->webcam_model) {
 		case SYNTEK_STK_0408:
@@ -106,7 +139,9 @@ int dev_stk11xx_initialize_device(struct usb_stk11xx *dev)
 			ret = -1;
 	}
 
-	return ret;
+	err = usb_stk11xx_end_registry(dev);
+
+	return ret ? ret : err;
 }
 
 
@@ -170,11 +205,123 @@ int dev_stk11xx_init_camera(struct usb_stk11xx *dev)
 }
 
 
+/** 
+ * @param dev Device structure
+ * @param op Register sequence
+ * @param values Values of the step (for STK11XX_OP_STEP)
+ * @param hook Function called by STK11XX_OP_HOOK
+ * 
+ * @returns Result of the last device check, 0 if none
+ *
+ * @brief Run a register sequence.
+ *
+ * The configure paths of the models are const tables of operations,
+ * played here. Like the hand-written sequences they replace, a failing
+ * write doesn't stop the sequence. The device checks are accounted to
+ * the sequence.
+ */
+int dev_stk11xx_run_sequence(struct usb_stk11xx *dev, const struct stk11xx_reg_op *op,
+		const unsigned char *values, int (*hook)(struct usb_stk11xx *))
+{
+	int ret = 0;
+	int value;
+	const struct stk11xx_reg_op *seq = op;
+
+	for (; op->op != STK11XX_OP_END; op++) {
+		switch (op->op) {
+			case STK11XX_OP_WRITE:
+				usb_stk11xx_write_registry(dev, op->reg, op->value);
+				break;
+
+			case STK11XX_OP_STEP:
+				usb_stk11xx_write_registry(dev, op->reg, values[op->value]);
+				break;
+
+			case STK11XX_OP_READ:
+				usb_stk11xx_read_registry(dev, op->reg, &value);
+				break;
+
+			case STK11XX_OP_SENSOR:
+				usb_stk11xx_write_registry(dev, 0x0204, op->reg);
+				usb_stk11xx_write_registry(dev, 0x0205, op->value);
+				break;
+
+			case STK11XX_OP_CHECK:
+				ret = dev_stk11xx_poll_device(dev, op->value, seq);
+				break;
+
+			case STK11XX_OP_SLEEP:
+				usb_stk11xx_wait_registry(dev);
+				msleep(op->value);
+				break;
+
+			case STK11XX_OP_HOOK:
+				if (hook != NULL)
+					hook(dev);
+				break;
+		}
+	}
+
+	return ret;
+}
+
+
+/** 
+ * @param dev Device structure
+ * @param site Caller of the check
+ * @param ret Result of the check
+ * @param start Start of the check
+ *
+ * @brief Account the wait of a device check to its caller.
+ */
+static void dev_stk11xx_poll_stat(struct usb_stk11xx *dev, const void *site, int ret, ktime_t start)
+{
+	int i;
+	unsigned int us;
+	struct stk11xx_poll_stat *stat;
+
+	// The last slot gathers the callers which don't fit
+	for (i=0; i<STK11XX_POLL_SITES-1; i++) {
+		stat = &dev->poll_stats[i];
+
+		if (stat->site == site)
+			break;
+
+		if (stat->site == NULL) {
+			stat->site = site;
+			break;
+		}
+	}
+
+	stat = &dev->poll_stats[i];
+	us = ktime_us_delta(ktime_get(), start);
+
+	stat->calls++;
+	stat->total_us += us;
+
+	if (us > stat->max_us)
+		stat->max_us = us;
+
+	if (ret == 0)
+		stat->timeouts++;
+	else if (ret < 0)
+		stat->errors++;
+
+	i = fls(us / 250);
+
+	if (i >= STK11XX_POLL_BUCKETS)
+		i = STK11XX_POLL_BUCKETS - 1;
+
+	stat->hist[i]++;
+}
+
+
 /** 
  * @param dev Device structure
  * @param nbr Number of tries
+ * @param site Caller, for the statistics
  * 
- * @returns 0 if all is OK
+ * @returns 1 if the device is ready, 0 if it isn't, -1 if it's misconfigured
  *
  * @brief This function permits to check the device in reading the register 0x0201.
  *
@@ -182,66 +329,280 @@ int dev_stk11xx_init_camera(struct usb_stk11xx *dev)
  *   - If the read value is 0x00, then the device isn't ready.
  *   - If the read value is 0x04, then the device is ready.
  *   - If the read value is other, then the device is misconfigured.
+ *
+ * The device is given some time before each read : the delay starts short and
+ * doubles at each try, and the check gives up after STK11XX_POLL_TIMEOUT ms.
  */
-int dev_stk11xx_check_device(struct usb_stk11xx *dev, int nbr)
+int dev_stk11xx_poll_device(struct usb_stk11xx *dev, int nbr, const void *site)
 {
 	int i;
+	int ret = 0;
 	int value;
+	ktime_t start;
+	ktime_t deadline;
+	unsigned int delay = STK11XX_POLL_DELAY_MIN;
+
+	// The delays start when the device got the queued writes
+	usb_stk11xx_wait_registry(dev);
+
+	start = ktime_get();
+	deadline = ktime_add_ms(start, STK11XX_POLL_TIMEOUT);
 
 	for (i=0; i<nbr; i++) {
+		usleep_range(delay, delay + delay / 2);
+
 		usb_stk11xx_read_registry(dev, 0x201, &value);
-		
-		if (value == 0x00) {
-		}
-		else if ((value == 0x11) || (value == 0x14)) {
-		}
-		else if ((value == 0x30) || (value == 0x31)) {
-		}
-		else if ((value == 0x51)) {
-		}
-		else if ((value == 0x70) || (value == 0x71)) {
-		}
-		else if ((value == 0x91)) {
-		}
-		else if (value == 0x01) {
-			return 1;
-		}
-		else if ((value == 0x04) || (value == 0x05))
-			return 1;
-		else if (value == 0x15) 
-			return 1;
-		else {
-			STK_ERROR("Check device return error (0x0201 = %02X) !\n", value);
-			return -1;
+
+		switch (value) {
+			case 0x00:
+			case 0x11:
+			case 0x14:
+			case 0x30:
+			case 0x31:
+			case 0x51:
+			case 0x70:
+			case 0x71:
+			case 0x91:
+				break;
+
+			case 0x01:
+			case 0x04:
+			case 0x05:
+			case 0x15:
+				ret = 1;
+				break;
+
+			default:
+				STK_ERROR("Check device return error (0x0201 = %02X) !\n", value);
+				ret = -1;
 		}
+
+		if (ret != 0)
+			break;
+
+		if (ktime_after(ktime_get(), deadline))
+			break;
+
+		delay = min(delay * 2, (unsigned int) STK11XX_POLL_DELAY_MAX);
 	}
 
-	return 0;
+	dev_stk11xx_poll_stat(dev, site, ret, start);
+
+	return ret;
 }
 
 
 /** 
  * @param dev Device structure
+ * @param nbr Number of tries
  * 
- * @returns Value of register 0x0001
+ * @returns 1 if the device is ready, 0 if it isn't, -1 if it's misconfigured
+ *
+ * @brief Check the device (see dev_stk11xx_poll_device).
+ */
+int dev_stk11xx_check_device(struct usb_stk11xx *dev, int nbr)
+{
+	return dev_stk11xx_poll_device(dev, nbr, (const void *) _RET_IP_);
+}
+
+
+/** 
+ * @param dev Device structure
+ * 
+ * @returns 0 if the camera answers, -EIO otherwise
  *
  * @brief A espece of software watchdog.
  *
- * This function reads periodically the value of register 0x0001.
+ * This function reads the value of register 0x0001.
  * 
  * We don't know the purpose. I assume that it seems to a software watchdog.
  */
 int dev_stk11xx_watchdog_camera(struct usb_stk11xx *dev)
 {
-	int value;
+	int err;
+	int value = 0;
 
-	usb_stk11xx_read_registry(dev, 0x0001, &value);
+	err = usb_stk11xx_read_registry(dev, 0x0001, &value);
 
-	if (value != 0x03) {
+	if ((err < 0) || (value != 0x03)) {
 		STK_DEBUG("Error : Register 0x0001 = %02X\n", value);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+
+/** 
+ * @param dev Device structure
+ *
+ * @brief Schedule the next check of the watchdog.
+ */
+static void dev_stk11xx_arm_watchdog(struct usb_stk11xx *dev)
+{
+	if (dev->watchdog_interval > 0)
+		schedule_delayed_work(&dev->watchdog_work, msecs_to_jiffies(dev->watchdog_interval));
+}
+
+
+/** 
+ * @param work Watchdog work of the device
+ *
+ * @brief Check the camera while it streams.
+ *
+ * The register read is done here, at its own pace, and not for each frame.
+ * After STK11XX_WATCHDOG_FAILURES failed checks in a row, the stream is
+ * restarted. If the camera can't be restarted, the consumers get an error.
+ */
+static void dev_stk11xx_watchdog_work(struct work_struct *work)
+{
+	int err;
+	struct stk11xx_fh *fh;
+	struct usb_stk11xx *dev = container_of(to_delayed_work(work), struct usb_stk11xx, watchdog_work);
+
+	// The device is busy, check it later
+	if (!mutex_trylock(&dev->modlock)) {
+		dev_stk11xx_arm_watchdog(dev);
+		return;
+	}
+
+	// The camera has been stopped in the meantime
+	if (!dev->streaming || !dev->isoc_init_ok) {
+		mutex_unlock(&dev->modlock);
+		return;
+	}
+
+	if (dev_stk11xx_watchdog_camera(dev) == 0)
+		dev->watchdog = 0;
+	else if (++dev->watchdog >= STK11XX_WATCHDOG_FAILURES) {
+		STK_ERROR("The camera doesn't answer, restart the stream\n");
+
+		dev->watchdog = 0;
+		dev->watchdog_resets++;
+
+		dev_stk11xx_stop_video(dev);
+
+		// The camera may have lost its registers
+		usb_stk11xx_invalidate_registry(dev);
+
+		// The frame buffers are reset under fh_lock, out of the frame work
+		err = dev_stk11xx_start_video(dev);
+
+		if (err) {
+			STK_ERROR("Failed to restart the camera !\n");
+
+			dev->error_status = EIO;
+
+			mutex_lock(&dev->fh_lock);
+			list_for_each_entry(fh, &dev->fh_list, list)
+				vb2_queue_error(&fh->vb_queue);
+			mutex_unlock(&dev->fh_lock);
+
+			mutex_unlock(&dev->modlock);
+			return;
+		}
 	}
 
-	return value;
+	dev_stk11xx_arm_watchdog(dev);
+
+	mutex_unlock(&dev->modlock);
+}
+
+
+/** 
+ * @param dev Device structure
+ *
+ * @brief Initialize the software watchdog.
+ *
+ * The watchdog only runs while the camera streams.
+ */
+void dev_stk11xx_init_watchdog(struct usb_stk11xx *dev)
+{
+	dev->watchdog = 0;
+	dev->watchdog_resets = 0;
+
+	INIT_DELAYED_WORK(&dev->watchdog_work, dev_stk11xx_watchdog_work);
+}
+
+
+/** 
+ * @param dev Device structure
+ * @param config Filled with the current configuration
+ */
+static void dev_stk11xx_get_config(struct usb_stk11xx *dev, struct stk11xx_config *config)
+{
+	// The structures are compared with memcmp
+	memset(config, 0, sizeof(struct stk11xx_config));
+
+	config->model = dev->webcam_model;
+	config->sensor = dev->image;
+	config->fps = dev->vsettings.fps;
+	config->norm = dev->vsettings.norm;
+	config->input = dev->vsettings.input;
+
+	config->brightness = dev->vsettings.brightness;
+	config->contrast = dev->vsettings.contrast;
+	config->whiteness = dev->vsettings.whiteness;
+	config->colour = dev->vsettings.colour;
+	config->hflip = dev->vsettings.hflip;
+	config->vflip = dev->vsettings.vflip;
+}
+
+
+/** 
+ * @param work Sleep work of the device
+ *
+ * @brief Put the camera asleep when no stream was started again.
+ */
+static void dev_stk11xx_sleep_work(struct work_struct *work)
+{
+	struct usb_stk11xx *dev = container_of(to_delayed_work(work), struct usb_stk11xx, sleep_work);
+
+	// The device is busy, try later
+	if (!mutex_trylock(&dev->modlock)) {
+		schedule_delayed_work(&dev->sleep_work, msecs_to_jiffies(STK11XX_SLEEP_DELAY));
+		return;
+	}
+
+	if (!dev->streaming)
+		dev_stk11xx_sleep(dev);
+
+	mutex_unlock(&dev->modlock);
+}
+
+
+/** 
+ * @param dev Device structure
+ *
+ * @brief Put the camera asleep now.
+ *
+ * The configuration of the camera is lost, the next start is a cold one.
+ * dev->modlock must be held.
+ */
+void dev_stk11xx_sleep(struct usb_stk11xx *dev)
+{
+	usb_stk11xx_begin_registry(dev);
+	dev_stk11xx_camera_asleep(dev);
+	usb_stk11xx_end_registry(dev);
+
+	dev->warm = 0;
+}
+
+
+/** 
+ * @param dev Device structure
+ *
+ * @brief Initialize the warm start.
+ *
+ * Until the camera has been initialized, every start is a cold one.
+ */
+void dev_stk11xx_init_sleep(struct usb_stk11xx *dev)
+{
+	dev->warm = 0;
+	dev->warm_starts = 0;
+	dev->cold_starts = 0;
+
+	INIT_DELAYED_WORK(&dev->sleep_work, dev_stk11xx_sleep_work);
 }
 
 
@@ -256,15 +617,7 @@ int dev_stk11xx_watchdog_camera(struct usb_stk11xx *dev)
  */
 int dev_stk11xx_camera_on(struct usb_stk11xx *dev)
 {
-	int ret = -1;
-	struct usb_device *udev = dev->udev;
-
-	ret = usb_set_interface(udev, 0, 5);
-
-	if (ret < 0)
-		STK_ERROR("usb_set_interface failed !\n");
-
-	return ret;
+	return usb_stk11xx_set_interface(dev, 5);
 }
 
 
@@ -279,13 +632,7 @@ int dev_stk11xx_camera_on(struct usb_stk11xx *dev)
  */
 int dev_stk11xx_camera_off(struct usb_stk11xx *dev)
 {
-	int ret = -1;
-	struct usb_device *udev = dev->udev;
-
-	ret = usb_set_interface(udev, 0, 0);
-
-	if (ret < 0)
-		STK_ERROR("usb_set_interface failed !\n");
+	usb_stk11xx_set_interface(dev, 0);
 
 	return 0;
 }
@@ -366,6 +713,9 @@ int dev_stk11xx_camera_asleep(struct usb_stk11xx *dev)
 int dev_stk11xx_camera_settings(struct usb_stk11xx *dev)
 {
 	int ret;
+	int err;
+
+	usb_stk11xx_begin_registry(dev);
 
 	switch (dev->webcam_model) {
 		case SYNTEK_STK_0408:
@@ -409,7 +759,9 @@ int dev_stk11xx_camera_settings(struct usb_stk11xx *dev)
 			ret = -1;
 	}
 
-	return ret;
+	err = usb_stk11xx_end_registry(dev);
+
+	return ret ? ret : err;
 }
 
 
@@ -476,6 +828,139 @@ int dev_stk11xx_set_camera_quality(struct usb_stk11xx *dev)
 }
 
 
+/** 
+ * @param dev Device structure
+ * @param resolution Index of the resolution
+ * @param rates Filled with the frame rates of the sensor, highest first
+ * 
+ * @returns Number of frame rates
+ *
+ * @brief Get the frame rates of the sensor in a resolution.
+ *
+ * Only the STK-A311 sensor has a programmable frame rate. The other models
+ * run at their native frame rate.
+ */
+static int dev_stk11xx_sensor_rates(struct usb_stk11xx *dev, int resolution, const int **rates)
+{
+	switch (dev->webcam_model) {
+		case SYNTEK_STK_M811:
+		case SYNTEK_STK_A311:
+			if (resolution >= STK11XX_720x576) {
+				*rates = stka311_sxga_rates;
+				return ARRAY_SIZE(stka311_sxga_rates);
+			}
+
+			*rates = stka311_vga_rates;
+			return ARRAY_SIZE(stka311_vga_rates);
+
+		case SYNTEK_STK_0408:
+			// The norm gives the frame rate of the source
+			if (dev->vsettings.norm == 0) {
+				*rates = stk11xx_ntsc_rates;
+				return ARRAY_SIZE(stk11xx_ntsc_rates);
+			}
+
+			*rates = stk11xx_native_rates;
+			return ARRAY_SIZE(stk11xx_native_rates);
+
+		default:
+			*rates = stk11xx_native_rates;
+			return ARRAY_SIZE(stk11xx_native_rates);
+	}
+}
+
+
+/** 
+ * @param dev Device structure
+ * @param resolution Index of the resolution
+ * @param rates Filled with the frame rates, highest first
+ * 
+ * @returns Number of frame rates
+ *
+ * @brief Get the frame rates delivered in a resolution.
+ *
+ * All the rates of stk11xx_frame_rates up to the highest rate of the sensor.
+ */
+int dev_stk11xx_frame_rates(struct usb_stk11xx *dev, int resolution, const int **rates)
+{
+	int i;
+	const int *sensor;
+
+	dev_stk11xx_sensor_rates(dev, resolution, &sensor);
+
+	for (i=0; i<ARRAY_SIZE(stk11xx_frame_rates)-1; i++) {
+		if (stk11xx_frame_rates[i] <= sensor[0])
+			break;
+	}
+
+	*rates = &stk11xx_frame_rates[i];
+
+	return ARRAY_SIZE(stk11xx_frame_rates) - i;
+}
+
+
+/** 
+ * @param dev Device structure
+ * @param fps Frame rate wished, 0 for the full rate of the sensor
+ * 
+ * @returns 0 if all is OK
+ *
+ * @brief This function permits to change the frame rate of the stream.
+ *
+ * The nearest frame rate delivered in the current resolution is taken (see
+ * dev_stk11xx_frame_rates). The sensor is set to the lowest frame rate it
+ * supports which isn't under it. Only when the sensor is still faster, the
+ * isoc handler skips the frames in excess.
+ */
+int dev_stk11xx_set_frame_rate(struct usb_stk11xx *dev, int fps)
+{
+	int i;
+	int best;
+	int nrates;
+	int sensor_fps;
+	const int *rates;
+
+	nrates = dev_stk11xx_frame_rates(dev, dev->resolution, &rates);
+
+	if (fps <= 0)
+		fps = rates[0];
+
+	best = rates[0];
+
+	for (i=1; i<nrates; i++) {
+		if (abs(rates[i] - fps) < abs(best - fps))
+			best = rates[i];
+	}
+
+	nrates = dev_stk11xx_sensor_rates(dev, dev->resolution, &rates);
+
+	sensor_fps = rates[0];
+
+	for (i=0; i<nrates; i++) {
+		if (rates[i] >= best)
+			sensor_fps = rates[i];
+	}
+
+	STK_DEBUG("Set frame rate %d fps (sensor %d fps, wished %d fps)\n", best, sensor_fps, fps);
+
+	dev->frame_rate = best;
+
+	// All the frames are delivered when the sensor runs at the rate wished
+	dev->frame_interval = (best < sensor_fps) ? NSEC_PER_SEC / best : 0;
+
+	if (sensor_fps == dev->vsettings.fps)
+		return 0;
+
+	dev->vsettings.fps = sensor_fps;
+
+	// The camera settings program it when the stream starts
+	if (!dev->streaming)
+		return 0;
+
+	return dev_stk11xx_set_camera_fps(dev);
+}
+
+
 /** 
  * @param dev Device structure
  * 
@@ -715,6 +1200,159 @@ int dev_stk11xx_stop_stream(struct usb_stk11xx *dev)
 }
 
 
+/** 
+ * @param dev Device structure
+ * 
+ * @returns 0 if all is OK
+ *
+ * @brief This function starts the camera and the video stream.
+ *
+ * It's called when the capture starts (VIDIOC_STREAMON or the first read),
+ * so the camera doesn't use the USB bandwidth while nobody is watching.
+ * The buffers are sized for the current video mode.
+ *
+ * When the camera is still configured for the same sensor mode (see
+ * dev_stk11xx_stop_video), only the stream is started.
+ */
+int dev_stk11xx_start_video(struct usb_stk11xx *dev)
+{
+	int err;
+	int warm;
+	struct stk11xx_config config;
+
+	// The frame work of the other consumers may run, as soon as a buffer is
+	// queued : it waits until the frame buffers are ready
+	mutex_lock(&dev->fh_lock);
+
+	// Allocate memory (sized for the selected mode)
+	err = stk11xx_allocate_buffers(dev);
+
+	if (err < 0) {
+		mutex_unlock(&dev->fh_lock);
+		STK_ERROR("Failed to allocate buffer memory !\n");
+		return err;
+	}
+
+	// Reset buffers and parameters
+	stk11xx_reset_buffers(dev);
+
+	mutex_unlock(&dev->fh_lock);
+
+	dev->vsync = 0;
+	dev->v1st_cap = 5;
+	dev->error_status = 0;
+	dev->visoc_errors = 0;
+	dev->vframes_error = 0;
+	dev->vframes_dumped = 0;
+
+	// The camera stays configured
+	cancel_delayed_work(&dev->sleep_work);
+
+	dev_stk11xx_get_config(dev, &config);
+
+	// Same sensor mode and no reset since the last start : warm start
+	warm = dev->warm && !memcmp(&config, &dev->warm_config, offsetof(struct stk11xx_config, brightness));
+
+	// The register writes are queued until the end of the sequence
+	usb_stk11xx_begin_registry(dev);
+
+	// Initialize the device
+	if (warm)
+		dev_stk11xx_camera_on(dev);
+	else {
+		dev_stk11xx_init_camera(dev);
+		dev_stk11xx_camera_on(dev);
+		dev_stk11xx_reconf_camera(dev);
+	}
+
+	// The recorded URBs follow the description of the stream
+	stk11xx_record_start(dev);
+
+	// Init Isoc and URB
+	err = usb_stk11xx_isoc_init(dev);
+
+	if (err) {
+		STK_ERROR("Failed to init ISOC stuff !\n");
+		usb_stk11xx_isoc_cleanup(dev);
+		dev_stk11xx_camera_off(dev);
+		dev_stk11xx_camera_asleep(dev);
+		usb_stk11xx_end_registry(dev);
+		dev->warm = 0;
+		return err;
+	}
+
+	// Start the video stream
+	dev_stk11xx_start_stream(dev);
+
+	// Video settings
+	if (!warm || memcmp(&config, &dev->warm_config, sizeof(struct stk11xx_config)))
+		dev_stk11xx_camera_settings(dev);
+
+	if (warm)
+		dev->warm_starts++;
+	else
+		dev->cold_starts++;
+
+	if (usb_stk11xx_end_registry(dev))
+		STK_ERROR("Some registers of the camera are not written !\n");
+	else {
+		dev->warm = 1;
+		dev->warm_config = config;
+	}
+
+	dev->watchdog = 0;
+	dev_stk11xx_arm_watchdog(dev);
+
+	return 0;
+}
+
+
+/** 
+ * @param dev Device structure
+ * 
+ * @returns 0 if all is OK
+ *
+ * @brief This function stops the video stream and the camera.
+ *
+ * The isoc URBs are killed and the camera is switched off. The buffers stay
+ * in the pool for the next capture.
+ *
+ * The camera keeps its configuration for STK11XX_SLEEP_DELAY ms, so a new
+ * stream in the meantime is a warm start. Then it's put asleep.
+ */
+int dev_stk11xx_stop_video(struct usb_stk11xx *dev)
+{
+	int asleep;
+
+	// A running check finds the camera stopped
+	cancel_delayed_work(&dev->watchdog_work);
+
+	usb_stk11xx_begin_registry(dev);
+
+	// Stop the video stream
+	dev_stk11xx_stop_stream(dev);
+
+	// ISOC and URB cleanup
+	usb_stk11xx_isoc_cleanup(dev);
+
+	// Switch off the camera
+	dev_stk11xx_camera_off(dev);
+
+	// A configured camera is put asleep later, if no stream starts again
+	asleep = !dev->warm;
+
+	if (asleep)
+		dev_stk11xx_camera_asleep(dev);
+
+	usb_stk11xx_end_registry(dev);
+
+	if (!asleep)
+		schedule_delayed_work(&dev->sleep_work, msecs_to_jiffies(STK11XX_SLEEP_DELAY));
+
+	return 0;
+}
+
+
 /** 
  * @param dev Device structure
  * 
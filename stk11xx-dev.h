@@ -34,6 +34,47 @@
 #ifndef STK11XX_DEV_H
 #define STK11XX_DEV_H
 
+
+/**
+ * @brief Opcodes of a register sequence
+ *
+ * A register sequence is a const table of stk11xx_reg_op, terminated by
+ * STK11XX_REG_END, and run by dev_stk11xx_run_sequence.
+ */
+typedef enum {
+	STK11XX_OP_END,				/**< End of the sequence */
+	STK11XX_OP_WRITE,			/**< Write value into reg */
+	STK11XX_OP_STEP,			/**< Write the column value of the step values into reg */
+	STK11XX_OP_READ,			/**< Read reg (the value is dropped) */
+	STK11XX_OP_SENSOR,			/**< Sensor write : reg into 0x0204, value into 0x0205 */
+	STK11XX_OP_CHECK,			/**< Poll 0x0201 until the device is ready (value tries) */
+	STK11XX_OP_SLEEP,			/**< Sleep value ms */
+	STK11XX_OP_HOOK				/**< Call the hook of the sequence */
+} T_STK11XX_REG_OPCODE;
+
+
+/**
+ * @brief One operation of a register sequence
+ */
+struct stk11xx_reg_op {
+	unsigned char op;			/**< Opcode (T_STK11XX_REG_OPCODE) */
+	unsigned short reg;			/**< Register */
+	unsigned short value;		/**< Value, column, tries or delay */
+};
+
+#define STK11XX_REG_WRITE(r, v)		{ STK11XX_OP_WRITE, (r), (v) }
+#define STK11XX_REG_STEP(r, c)		{ STK11XX_OP_STEP, (r), (c) }
+#define STK11XX_REG_READ(r)			{ STK11XX_OP_READ, (r), 0 }
+#define STK11XX_REG_SENSOR(r, v)	{ STK11XX_OP_SENSOR, (r), (v) }
+#define STK11XX_REG_CHECK(n)		{ STK11XX_OP_CHECK, 0, (n) }
+#define STK11XX_REG_SLEEP(ms)		{ STK11XX_OP_SLEEP, 0, (ms) }
+#define STK11XX_REG_HOOK			{ STK11XX_OP_HOOK, 0, 0 }
+#define STK11XX_REG_END				{ STK11XX_OP_END, 0, 0 }
+
+
+int dev_stk11xx_run_sequence(struct usb_stk11xx *, const struct stk11xx_reg_op *,
+		const unsigned char *, int (*)(struct usb_stk11xx *));
+
 int dev_stk0408_initialize_device(struct usb_stk11xx *);
 int dev_stk0408_configure_device(struct usb_stk11xx *, int);
 int dev_stk0408_start_stream(struct usb_stk11xx *);
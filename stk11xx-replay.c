@@ -0,0 +1,681 @@
+/**
+ * @file stk11xx-replay.c
+ * @author Nicolas VIVIEN
+ * @date 2026-10-18
+ * @version v2.2.x
+ *
+ * @brief Driver for Syntek USB video camera
+ *
+ * @note Copyright (C) Nicolas VIVIEN
+ *
+ * @par Licences
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ * @par SubVersion
+ *   $Date$
+ *   $Revision$
+ *   $Author$
+ *   $HeadURL$
+ */
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/version.h>
+#include <linux/errno.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h>
+#include <linux/debugfs.h>
+#include <linux/kthread.h>
+#include <linux/hrtimer.h>
+#include <linux/platform_device.h>
+
+#include <linux/usb.h>
+#include <media/v4l2-common.h>
+#include <media/v4l2-ioctl.h>
+
+#include "stk11xx.h"
+
+
+/**
+ * @var stk11xx_replay_devices
+ *   Platform devices of the virtual cameras
+ */
+static struct platform_device *stk11xx_replay_devices[STK11XX_REPLAY_MAX];
+
+/**
+ * @var stk11xx_replay_registered
+ *   The driver of the virtual cameras is registered
+ */
+static int stk11xx_replay_registered;
+
+
+/**
+ * @param model Webcam model
+ *
+ * @returns Type of the camera, -1 if the driver doesn't know the model
+ */
+static int stk11xx_replay_type(int model)
+{
+	switch (model) {
+		case SYNTEK_STK_A311:
+		case SYNTEK_STK_M811:
+			return STK11XX_SXGA;
+
+		case SYNTEK_STK_0408:
+			return STK11XX_PAL;
+
+		case SYNTEK_STK_A821:
+		case SYNTEK_STK_AA11:
+		case SYNTEK_STK_6A31:
+		case SYNTEK_STK_6A33:
+		case SYNTEK_STK_6A51:
+		case SYNTEK_STK_6A54:
+		case SYNTEK_STK_6D51:
+		case SYNTEK_STK_0500:
+			return STK11XX_VGA;
+	}
+
+	return -1;
+}
+
+
+/**
+ * @param data Recording
+ * @param size Bytes of the recording
+ * @param pos Offset of a record
+ *
+ * @returns Size of the record, 0 if it's truncated or invalid
+ *
+ * @brief Check a record before it's played.
+ *
+ * The recording comes from the user : a record is only played when its
+ * descriptors and its packets fit in it and in the URB of the player.
+ */
+static size_t stk11xx_replay_check(const void *data, size_t size, size_t pos)
+{
+	int i;
+	size_t expected;
+	const struct stk11xx_rec_header *header;
+	const struct stk11xx_rec_packet *packet;
+
+	if (size - pos < sizeof(*header))
+		return 0;
+
+	header = data + pos;
+
+	if ((header->magic != STK11XX_RECORD_MAGIC) || (header->size > size - pos))
+		return 0;
+
+	switch (header->type) {
+		case STK11XX_RECORD_START:
+			expected = sizeof(*header) + sizeof(struct stk11xx_rec_start);
+			break;
+
+		case STK11XX_RECORD_URB:
+			// Headers only can't give a frame
+			if ((header->mode != STK11XX_RECORD_PAYLOADS) || (header->count > ISO_FRAMES_PER_DESC))
+				return 0;
+
+			expected = sizeof(*header) + header->count * sizeof(*packet);
+
+			if (expected > header->size)
+				return 0;
+
+			packet = (const void *) (header + 1);
+
+			for (i=0; i<header->count; i++) {
+				if ((packet[i].recorded > ISO_MAX_FRAME_SIZE) || (packet[i].recorded > packet[i].length))
+					return 0;
+
+				expected += packet[i].recorded;
+			}
+			break;
+
+		default:
+			return 0;
+	}
+
+	if (expected != header->size)
+		return 0;
+
+	return header->size;
+}
+
+
+/**
+ * @param dev Device structure
+ *
+ * @returns 0 if all is OK
+ *
+ * @brief Find the stream to play.
+ *
+ * The whole recording is checked, and the first stream recorded with the
+ * sensor mode of the device is selected.
+ */
+static int stk11xx_replay_find(struct usb_stk11xx *dev)
+{
+	size_t pos;
+	size_t len;
+	int found = 0;
+	int urbs = 0;
+
+	const struct stk11xx_rec_header *header;
+	const struct stk11xx_rec_start *start = NULL;
+	struct stk11xx_replay *replay = dev->replay;
+
+	if (replay->data == NULL) {
+		STK_ERROR("No recording to play\n");
+		return -ENODATA;
+	}
+
+	for (pos=0; pos<replay->size; pos+=len) {
+		len = stk11xx_replay_check(replay->data, replay->size, pos);
+
+		if (len == 0) {
+			STK_ERROR("Invalid record at offset %zu\n", pos);
+			return -EINVAL;
+		}
+
+		header = replay->data + pos;
+
+		if (header->type == STK11XX_RECORD_START) {
+			// The stream ends at the next start
+			if (found)
+				break;
+
+			start = (const void *) (header + 1);
+
+			if (start->resolution == dev->resolution) {
+				replay->first = pos;
+				found = 1;
+			}
+		}
+		else if (found)
+			urbs++;
+	}
+
+	if (urbs == 0) {
+		STK_ERROR("No stream recorded at %dx%d\n",
+				stk11xx_image_sizes[dev->resolution].x, stk11xx_image_sizes[dev->resolution].y);
+		return -EINVAL;
+	}
+
+	start = replay->data + replay->first + sizeof(*header);
+
+	dev->speed = start->speed;
+	dev->isoc_in_size = start->packet_size;
+
+	return 0;
+}
+
+
+/**
+ * @param dev Device structure
+ * @param header Record of the URB
+ *
+ * @brief Give a recorded URB to the reassembly, as the isoc handler does.
+ */
+static void stk11xx_replay_urb(struct usb_stk11xx *dev, const struct stk11xx_rec_header *header)
+{
+	int i;
+	const unsigned char *payload;
+	const struct stk11xx_rec_packet *packet;
+	struct urb *urb = dev->replay->urb;
+
+	packet = (const void *) (header + 1);
+	payload = (const void *) (packet + header->count);
+
+	urb->status = header->status;
+	urb->number_of_packets = header->count;
+
+	for (i=0; i<header->count; i++) {
+		urb->iso_frame_desc[i].offset = i * ISO_MAX_FRAME_SIZE;
+		urb->iso_frame_desc[i].status = packet[i].status;
+		urb->iso_frame_desc[i].actual_length = packet[i].recorded;
+
+		memcpy(urb->transfer_buffer + urb->iso_frame_desc[i].offset, payload, packet[i].recorded);
+		payload += packet[i].recorded;
+	}
+
+	stk11xx_record_urb(dev, urb);
+
+	usb_stk11xx_isoc_packets(dev, urb);
+}
+
+
+/**
+ * @param deadline Time to wait for
+ *
+ * @brief Wait until a recorded URB is due, or until the player is stopped.
+ */
+static void stk11xx_replay_wait(ktime_t deadline)
+{
+	set_current_state(TASK_INTERRUPTIBLE);
+
+	if (!kthread_should_stop())
+		schedule_hrtimeout(&deadline, HRTIMER_MODE_ABS);
+
+	__set_current_state(TASK_RUNNING);
+}
+
+
+/**
+ * @param data Device structure
+ *
+ * @returns 0
+ *
+ * @brief Player of a virtual camera.
+ *
+ * The URBs of the stream are given at their recorded pace, or as fast as
+ * possible, and the stream is played again until the camera is stopped.
+ */
+static int stk11xx_replay_thread(void *data)
+{
+	size_t pos;
+	ktime_t base;
+	u64 origin;
+
+	struct usb_stk11xx *dev = data;
+	struct stk11xx_replay *replay = dev->replay;
+	const struct stk11xx_rec_header *header;
+
+	while (!kthread_should_stop()) {
+		header = replay->data + replay->first;
+
+		base = ktime_get();
+		origin = header->timestamp;
+
+		for (pos=replay->first+header->size; pos<replay->size; pos+=header->size) {
+			header = replay->data + pos;
+
+			if (header->type == STK11XX_RECORD_START)
+				break;
+
+			if (replay->max_rate)
+				cond_resched();
+			else if (header->timestamp > origin)
+				stk11xx_replay_wait(ktime_add_ns(base, header->timestamp - origin));
+
+			if (kthread_should_stop())
+				break;
+
+			stk11xx_replay_urb(dev, header);
+			replay->urbs++;
+		}
+
+		replay->loops++;
+	}
+
+	return 0;
+}
+
+
+/**
+ * @param dev Device structure
+ *
+ * @returns 0 if all is OK
+ *
+ * @brief Start the player, in place of the isoc URBs.
+ */
+int stk11xx_replay_start(struct usb_stk11xx *dev)
+{
+	int err;
+	struct task_struct *thread;
+	struct stk11xx_replay *replay = dev->replay;
+
+	mutex_lock(&replay->lock);
+
+	err = stk11xx_replay_find(dev);
+
+	if (err)
+		goto out;
+
+	thread = kthread_run(stk11xx_replay_thread, dev, "stk11xx-replay/%d", replay->pdev->id);
+
+	if (IS_ERR(thread)) {
+		err = PTR_ERR(thread);
+		goto out;
+	}
+
+	replay->thread = thread;
+
+out:
+	mutex_unlock(&replay->lock);
+
+	return err;
+}
+
+
+/**
+ * @param dev Device structure
+ *
+ * @brief Stop the player.
+ */
+void stk11xx_replay_stop(struct usb_stk11xx *dev)
+{
+	struct stk11xx_replay *replay = dev->replay;
+
+	mutex_lock(&replay->lock);
+
+	if (replay->thread != NULL) {
+		kthread_stop(replay->thread);
+		replay->thread = NULL;
+	}
+
+	mutex_unlock(&replay->lock);
+}
+
+
+/**
+ * @brief Write the recording to play
+ *
+ * A write at the start of the file replaces the recording, the next ones
+ * append to it. The model of the camera is taken from the recording.
+ */
+static ssize_t stk11xx_replay_load_write(struct file *fp, const char __user *buf, size_t count, loff_t *ppos)
+{
+	int err = 0;
+	size_t alloc;
+	void *data;
+
+	struct usb_stk11xx *dev = fp->private_data;
+	struct stk11xx_replay *replay = dev->replay;
+	const struct stk11xx_rec_header *header;
+	const struct stk11xx_rec_start *start;
+
+	if ((*ppos < 0) || (*ppos > STK11XX_REPLAY_SIZE) || (count > STK11XX_REPLAY_SIZE - *ppos))
+		return -EFBIG;
+
+	mutex_lock(&dev->modlock);
+	mutex_lock(&replay->lock);
+
+	// Not while the recording is played, nor when the format may be chosen
+	if ((replay->thread != NULL) || ((*ppos == 0) && dev->vopen)) {
+		err = -EBUSY;
+		goto out;
+	}
+
+	if (*ppos == 0)
+		replay->size = 0;
+
+	if (*ppos != replay->size) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	if (replay->size + count > replay->alloc) {
+		alloc = max_t(size_t, replay->alloc * 2, PAGE_ALIGN(replay->size + count));
+		alloc = min_t(size_t, alloc, STK11XX_REPLAY_SIZE);
+
+		data = vmalloc(alloc);
+
+		if (data == NULL) {
+			err = -ENOMEM;
+			goto out;
+		}
+
+		if (replay->data != NULL)
+			memcpy(data, replay->data, replay->size);
+
+		vfree(replay->data);
+
+		replay->data = data;
+		replay->alloc = alloc;
+	}
+
+	if (copy_from_user(replay->data + replay->size, buf, count)) {
+		err = -EFAULT;
+		goto out;
+	}
+
+	// A recording starts with the description of its stream
+	if ((replay->size == 0) && stk11xx_replay_check(replay->data, count, 0)) {
+		header = replay->data;
+		start = (const void *) (header + 1);
+
+		// The model selects the code run on the device
+		if ((header->type == STK11XX_RECORD_START) && (stk11xx_replay_type(start->model) < 0)) {
+			STK_ERROR("Unknown model %d in the recording\n", start->model);
+			err = -EINVAL;
+			goto out;
+		}
+
+		if ((header->type == STK11XX_RECORD_START) && (start->model != dev->webcam_model)) {
+			dev->webcam_model = start->model;
+			dev->webcam_type = stk11xx_replay_type(start->model);
+
+			STK_INFO("Virtual camera %d plays a recording of model %d\n", replay->pdev->id, start->model);
+		}
+	}
+
+	replay->size += count;
+	*ppos += count;
+
+out:
+	mutex_unlock(&replay->lock);
+	mutex_unlock(&dev->modlock);
+
+	return err ? err : count;
+}
+
+
+/**
+ * @var stk11xx_replay_load_fops
+ */
+static const struct file_operations stk11xx_replay_load_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = stk11xx_replay_load_write,
+	.llseek = default_llseek,
+};
+
+
+/**
+ * @param pdev Platform device of the virtual camera
+ *
+ * @returns 0 if all is OK
+ *
+ * @brief Create a virtual camera.
+ *
+ * It's registered as a USB camera is, and it gets a few more entries in the
+ * debugfs :
+ *   - replay : the recording to play
+ *   - replay_max_rate : 1 to play as fast as possible
+ *   - replay_urbs, replay_loops : URBs and streams played
+ */
+static int stk11xx_replay_probe(struct platform_device *pdev)
+{
+	int err;
+	struct usb_stk11xx *dev;
+	struct stk11xx_replay *replay;
+
+	replay = kzalloc(sizeof(struct stk11xx_replay), GFP_KERNEL);
+
+	if (replay == NULL)
+		return -ENOMEM;
+
+	mutex_init(&replay->lock);
+	replay->pdev = pdev;
+
+	replay->urb = usb_alloc_urb(ISO_FRAMES_PER_DESC, GFP_KERNEL);
+	replay->buffer = kmalloc(ISO_BUFFER_SIZE, GFP_KERNEL);
+
+	dev = usb_stk11xx_alloc(SYNTEK_STK_A821, STK11XX_VGA);
+
+	if ((replay->urb == NULL) || (replay->buffer == NULL) || (dev == NULL)) {
+		err = -ENOMEM;
+		goto error;
+	}
+
+	// The registers are those of a simulator
+	err = stk11xx_sim_attach(dev);
+
+	if (err)
+		goto error;
+
+	replay->urb->context = dev;
+	replay->urb->transfer_buffer = replay->buffer;
+	replay->urb->transfer_buffer_length = ISO_BUFFER_SIZE;
+
+	dev->replay = replay;
+	dev->parent = &pdev->dev;
+	dev->speed = USB_SPEED_HIGH;
+
+	err = usb_stk11xx_register(dev);
+
+	if (err) {
+		stk11xx_sim_detach(dev);
+		goto error;
+	}
+
+	platform_set_drvdata(pdev, dev);
+
+	if (!IS_ERR_OR_NULL(dev->debugfs)) {
+		debugfs_create_file("replay", 0200, dev->debugfs, dev, &stk11xx_replay_load_fops);
+		debugfs_create_u32("replay_max_rate", 0600, dev->debugfs, &replay->max_rate);
+		debugfs_create_u32("replay_urbs", 0400, dev->debugfs, &replay->urbs);
+		debugfs_create_u32("replay_loops", 0400, dev->debugfs, &replay->loops);
+	}
+
+	STK_INFO("Virtual camera %d created\n", pdev->id);
+
+	return 0;
+
+error:
+	kfree(dev);
+	kfree(replay->buffer);
+	usb_free_urb(replay->urb);
+	kfree(replay);
+
+	return err;
+}
+
+
+/**
+ * @param pdev Platform device of the virtual camera
+ *
+ * @returns 0 on the kernels that still expect a value
+ *
+ * @brief Remove a virtual camera.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+static void stk11xx_replay_remove(struct platform_device *pdev)
+#else
+static int stk11xx_replay_remove(struct platform_device *pdev)
+#endif
+{
+	struct usb_stk11xx *dev = platform_get_drvdata(pdev);
+	struct stk11xx_replay *replay = dev->replay;
+
+	usb_stk11xx_unregister(dev);
+	stk11xx_sim_detach(dev);
+
+	vfree(replay->data);
+	kfree(replay->buffer);
+	usb_free_urb(replay->urb);
+	kfree(replay);
+
+	platform_set_drvdata(pdev, NULL);
+	kfree(dev);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,3,0)
+
+	return 0;
+#endif
+}
+
+
+/**
+ * @var stk11xx_replay_driver
+ */
+static struct platform_driver stk11xx_replay_driver = {
+	.driver = {
+		.name = "stk11xx-replay",
+	},
+	.probe = stk11xx_replay_probe,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0) && LINUX_VERSION_CODE < KERNEL_VERSION(6,11,0)
+	.remove_new = stk11xx_replay_remove,
+#else
+	.remove = stk11xx_replay_remove,
+#endif
+};
+
+
+/**
+ * @param count Number of virtual cameras
+ *
+ * @returns 0 if all is OK
+ *
+ * @brief Create the virtual cameras.
+ */
+int stk11xx_replay_init(int count)
+{
+	int i;
+	int err;
+	struct platform_device *pdev;
+
+	if (count <= 0)
+		return 0;
+
+	if (count > STK11XX_REPLAY_MAX) {
+		STK_ERROR("Too many virtual cameras [0-%d] !\n", STK11XX_REPLAY_MAX);
+		return -EINVAL;
+	}
+
+	err = platform_driver_register(&stk11xx_replay_driver);
+
+	if (err)
+		return err;
+
+	stk11xx_replay_registered = 1;
+
+	for (i=0; i<count; i++) {
+		pdev = platform_device_register_simple("stk11xx-replay", i, NULL, 0);
+
+		if (IS_ERR(pdev)) {
+			err = PTR_ERR(pdev);
+			stk11xx_replay_exit();
+			return err;
+		}
+
+		stk11xx_replay_devices[i] = pdev;
+	}
+
+	return 0;
+}
+
+
+/**
+ * @brief Remove the virtual cameras.
+ */
+void stk11xx_replay_exit(void)
+{
+	int i;
+
+	for (i=0; i<STK11XX_REPLAY_MAX; i++) {
+		if (stk11xx_replay_devices[i] == NULL)
+			continue;
+
+		platform_device_unregister(stk11xx_replay_devices[i]);
+		stk11xx_replay_devices[i] = NULL;
+	}
+
+	if (stk11xx_replay_registered)
+		platform_driver_unregister(&stk11xx_replay_driver);
+
+	stk11xx_replay_registered = 0;
+}
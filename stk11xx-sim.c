@@ -0,0 +1,604 @@
+/**
+ * @file stk11xx-sim.c
+ * @author Nicolas VIVIEN
+ * @date 2026-10-18
+ * @version v2.2.x
+ *
+ * @brief Driver for Syntek USB video camera
+ *
+ * @note Copyright (C) Nicolas VIVIEN
+ *
+ * @par Licences
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ * @par SubVersion
+ *   $Date$
+ *   $Revision$
+ *   $Author$
+ *   $HeadURL$
+ */
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/version.h>
+#include <linux/errno.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/debugfs.h>
+
+#include <linux/usb.h>
+#include <media/v4l2-common.h>
+#include <media/v4l2-ioctl.h>
+
+#include "stk11xx.h"
+
+
+/**
+ * @var stk11xx_sim_script
+ *   Script of the simulators : the serial bus transactions started by the
+ *   writes of 0x0200. The writes end with 0x04, the reads with 0x01.
+ */
+static struct stk11xx_sim_rule stk11xx_sim_script[STK11XX_SIM_RULES] = {
+	{ 0x0200, 0x0001, 200, 0x04 },
+	{ 0x0200, 0x0005, 200, 0x04 },
+	{ 0x0200, 0x0006, 200, 0x04 },
+	{ 0x0200, 0x0020, 300, 0x01 },
+	{ 0x0200, 0x0021, 300, 0x01 },
+	{ 0x0200, 0x0061, 300, 0x01 },
+};
+
+/**
+ * @var stk11xx_sim_nrules
+ *   Rules of stk11xx_sim_script
+ */
+static int stk11xx_sim_nrules = 6;
+
+/**
+ * @var stk11xx_sim_lock
+ *   Protect the script
+ */
+static DEFINE_MUTEX(stk11xx_sim_lock);
+
+
+/**
+ * @struct stk11xx_sim_model
+ */
+struct stk11xx_sim_model {
+	int model;							/**< Webcam model */
+	int type;							/**< Type of the camera */
+	const char *name;					/**< Name in the report */
+};
+
+
+/**
+ * @var stk11xx_sim_models
+ *   Models run by the harness (the models which share their code are left out)
+ */
+static const struct stk11xx_sim_model stk11xx_sim_models[] = {
+	{ SYNTEK_STK_A311, STK11XX_SXGA, "a311" },
+	{ SYNTEK_STK_A821, STK11XX_VGA, "a821" },
+	{ SYNTEK_STK_6A31, STK11XX_VGA, "6a31" },
+	{ SYNTEK_STK_6A33, STK11XX_VGA, "6a33" },
+	{ SYNTEK_STK_6A51, STK11XX_VGA, "6a51" },
+	{ SYNTEK_STK_6A54, STK11XX_VGA, "6a54" },
+	{ SYNTEK_STK_6D51, STK11XX_VGA, "6d51" },
+	{ SYNTEK_STK_0500, STK11XX_VGA, "0500" },
+	{ SYNTEK_STK_0408, STK11XX_PAL, "0408" },
+};
+
+
+/**
+ * @struct stk11xx_sim_sequence
+ */
+struct stk11xx_sim_sequence {
+	const char *name;					/**< Name in the report */
+	int (*run)(struct usb_stk11xx *);	/**< Sequence */
+};
+
+
+/**
+ * @var stk11xx_sim_sequences
+ *   Sequences run by the harness, in the order of the driver
+ */
+static const struct stk11xx_sim_sequence stk11xx_sim_sequences[] = {
+	{ "initialize", dev_stk11xx_initialize_device },
+	{ "init_camera", dev_stk11xx_init_camera },
+	{ "settings", dev_stk11xx_camera_settings },
+	{ "start_stream", dev_stk11xx_start_stream },
+	{ "stop_stream", dev_stk11xx_stop_stream },
+};
+
+
+/**
+ * @param sim Simulator
+ *
+ * @returns Time of the clock (ns)
+ */
+static u64 stk11xx_sim_now(struct stk11xx_sim *sim)
+{
+	return ktime_to_ns(ktime_sub(ktime_get(), sim->start)) + sim->bus_ns;
+}
+
+
+/**
+ * @param sim Simulator
+ *
+ * @brief Restart the clock and the counters.
+ */
+static void stk11xx_sim_reset(struct stk11xx_sim *sim)
+{
+	sim->start = ktime_get();
+	sim->bus_ns = 0;
+	sim->busy_until = 0;
+
+	sim->writes = 0;
+	sim->reads = 0;
+	sim->polls = 0;
+	sim->interfaces = 0;
+	sim->requests = 0;
+}
+
+
+/**
+ * @param sim Simulator
+ *
+ * @brief A transfer takes some time on the bus.
+ */
+static void stk11xx_sim_transfer(struct stk11xx_sim *sim)
+{
+	sim->bus_ns += STK11XX_SIM_TRANSFER_US * NSEC_PER_USEC;
+}
+
+
+/**
+ * @param dev Device structure
+ * @param index Register
+ * @param value Value
+ *
+ * @returns 0
+ *
+ * @brief Write a register of the simulator
+ */
+static int stk11xx_sim_write(struct usb_stk11xx *dev, __u16 index, __u16 value)
+{
+	int i;
+	struct stk11xx_sim *sim = dev->sim;
+
+	stk11xx_sim_transfer(sim);
+	sim->writes++;
+
+	if (index < STK11XX_REG_SHADOW)
+		sim->regs[index] = value;
+
+	for (i=0; i<sim->nrules; i++) {
+		if ((sim->rules[i].reg == index) && (sim->rules[i].value == value)) {
+			sim->busy_until = stk11xx_sim_now(sim) + sim->rules[i].busy_us * NSEC_PER_USEC;
+			sim->status = sim->rules[i].status;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * @param dev Device structure
+ * @param index Register
+ * @param value Value read
+ *
+ * @returns Bytes read
+ *
+ * @brief Read a register of the simulator
+ *
+ * The status 0x0201 follows the script, the GPIO 0x0001 keeps the watchdog
+ * happy, and the other registers give their last value.
+ */
+static int stk11xx_sim_read(struct usb_stk11xx *dev, __u16 index, int *value)
+{
+	struct stk11xx_sim *sim = dev->sim;
+
+	stk11xx_sim_transfer(sim);
+
+	switch (index) {
+		case 0x0001:
+			sim->reads++;
+			*value = 0x03;
+			break;
+
+		case 0x0201:
+			sim->polls++;
+			*value = (stk11xx_sim_now(sim) < sim->busy_until) ? 0x00 : sim->status;
+			break;
+
+		default:
+			sim->reads++;
+			*value = (index < STK11XX_REG_SHADOW) ? sim->regs[index] : 0;
+	}
+
+	return sizeof(__u8);
+}
+
+
+/**
+ * @param dev Device structure
+ * @param alternate Alternate setting
+ *
+ * @returns 0
+ */
+static int stk11xx_sim_set_interface(struct usb_stk11xx *dev, int alternate)
+{
+	struct stk11xx_sim *sim = dev->sim;
+
+	stk11xx_sim_transfer(sim);
+	sim->interfaces++;
+	sim->alternate = alternate;
+
+	return 0;
+}
+
+
+/**
+ * @param dev Device structure
+ * @param index Choice of the interface
+ *
+ * @returns 0
+ */
+static int stk11xx_sim_set_feature(struct usb_stk11xx *dev, int index)
+{
+	struct stk11xx_sim *sim = dev->sim;
+
+	stk11xx_sim_transfer(sim);
+	sim->requests++;
+
+	return 0;
+}
+
+
+/**
+ * @param dev Device structure
+ *
+ * @returns 0
+ *
+ * @brief The simulator is reset.
+ */
+static int stk11xx_sim_set_configuration(struct usb_stk11xx *dev)
+{
+	struct stk11xx_sim *sim = dev->sim;
+
+	stk11xx_sim_transfer(sim);
+	sim->requests++;
+
+	memset(sim->regs, 0, sizeof(sim->regs));
+	sim->alternate = 0;
+	sim->status = 0x04;
+	sim->busy_until = 0;
+
+	return 0;
+}
+
+
+/**
+ * @var stk11xx_sim_bus_ops
+ *
+ * Transfers of a simulated camera
+ */
+const struct stk11xx_bus_ops stk11xx_sim_bus_ops = {
+	.write = stk11xx_sim_write,
+	.read = stk11xx_sim_read,
+	.set_interface = stk11xx_sim_set_interface,
+	.set_feature = stk11xx_sim_set_feature,
+	.set_configuration = stk11xx_sim_set_configuration,
+};
+
+
+/**
+ * @param dev Device structure
+ *
+ * @returns 0 if all is OK
+ *
+ * @brief Give a simulator to the device, in place of the USB bus.
+ *
+ * The simulator takes the script as it is now.
+ */
+int stk11xx_sim_attach(struct usb_stk11xx *dev)
+{
+	struct stk11xx_sim *sim;
+
+	sim = kzalloc(sizeof(struct stk11xx_sim), GFP_KERNEL);
+
+	if (sim == NULL)
+		return -ENOMEM;
+
+	mutex_lock(&stk11xx_sim_lock);
+	memcpy(sim->rules, stk11xx_sim_script, sizeof(sim->rules));
+	sim->nrules = stk11xx_sim_nrules;
+	mutex_unlock(&stk11xx_sim_lock);
+
+	sim->status = 0x04;
+	stk11xx_sim_reset(sim);
+
+	dev->sim = sim;
+	dev->bus = &stk11xx_sim_bus_ops;
+
+	return 0;
+}
+
+
+/**
+ * @param dev Device structure
+ *
+ * @brief Release the simulator of the device.
+ */
+void stk11xx_sim_detach(struct usb_stk11xx *dev)
+{
+	kfree(dev->sim);
+
+	dev->sim = NULL;
+	dev->bus = NULL;
+}
+
+
+/**
+ * @param dev Device structure
+ * @param name Name of the model
+ * @param buf Report
+ * @param size Size of the report
+ *
+ * @returns Length of the report
+ *
+ * @brief Run the sequences of a simulated camera.
+ *
+ * The sequences run one after the other, as the driver runs them from the
+ * probe to the first capture, so the register shadow works as it does with
+ * a camera.
+ */
+static int stk11xx_sim_run(struct usb_stk11xx *dev, const char *name, char *buf, size_t size)
+{
+	int i;
+	int ret;
+	int err;
+	int len = 0;
+	unsigned int saved;
+
+	struct stk11xx_sim *sim = dev->sim;
+	const struct stk11xx_sim_sequence *seq;
+
+	mutex_lock(&dev->modlock);
+
+	for (i=0; i<ARRAY_SIZE(stk11xx_sim_sequences); i++) {
+		seq = &stk11xx_sim_sequences[i];
+
+		stk11xx_sim_reset(sim);
+		saved = dev->reg_writes_saved + dev->reg_reads_saved;
+
+		usb_stk11xx_begin_registry(dev);
+		ret = seq->run(dev);
+		err = usb_stk11xx_end_registry(dev);
+
+		len += scnprintf(buf + len, size - len, "%-6s %-12s %6u %6u %6u %6u %6u %6u %9llu %4d\n",
+				name, seq->name, sim->writes, sim->reads, sim->polls, sim->interfaces, sim->requests,
+				dev->reg_writes_saved + dev->reg_reads_saved - saved,
+				div_u64(stk11xx_sim_now(sim), NSEC_PER_USEC), ret ? ret : err);
+	}
+
+	mutex_unlock(&dev->modlock);
+
+	return len;
+}
+
+
+/**
+ * @param buf Report
+ * @param size Size of the report
+ *
+ * @returns Length of the report
+ *
+ * @brief Run the sequences of every model against the simulator.
+ */
+static int stk11xx_sim_harness(char *buf, size_t size)
+{
+	int i;
+	int len;
+	struct usb_stk11xx *dev;
+	const struct stk11xx_sim_model *model;
+
+	len = scnprintf(buf, size, "%-6s %-12s %6s %6s %6s %6s %6s %6s %9s %4s\n",
+			"model", "sequence", "writes", "reads", "polls", "iface", "reqs", "saved", "time(us)", "ret");
+
+	for (i=0; i<ARRAY_SIZE(stk11xx_sim_models); i++) {
+		model = &stk11xx_sim_models[i];
+
+		dev = usb_stk11xx_alloc(model->model, model->type);
+
+		if (dev == NULL)
+			return -ENOMEM;
+
+		if (stk11xx_sim_attach(dev)) {
+			kfree(dev);
+			return -ENOMEM;
+		}
+
+		// As the probe and the first open
+		usb_stk11xx_default_settings(dev);
+
+		dev->vsettings.depth = 24;
+		dev->vsettings.palette = STK11XX_PALETTE_BGR24;
+
+		v4l_stk11xx_select_video_mode(dev, 640, 480);
+
+		len += stk11xx_sim_run(dev, model->name, buf + len, size - len);
+
+		stk11xx_sim_detach(dev);
+		kfree(dev);
+	}
+
+	return len;
+}
+
+
+/**
+ * @brief Run the harness : the report is read from the file
+ */
+static int stk11xx_sim_report_open(struct inode *inode, struct file *fp)
+{
+	int len;
+	char *buf;
+
+	buf = kzalloc(4 * PAGE_SIZE, GFP_KERNEL);
+
+	if (buf == NULL)
+		return -ENOMEM;
+
+	len = stk11xx_sim_harness(buf, 4 * PAGE_SIZE);
+
+	if (len < 0) {
+		kfree(buf);
+		return len;
+	}
+
+	fp->private_data = buf;
+
+	return nonseekable_open(inode, fp);
+}
+
+
+/**
+ * @brief Read the report of the harness
+ */
+static ssize_t stk11xx_sim_report_read(struct file *fp, char __user *buf, size_t count, loff_t *ppos)
+{
+	char *report = fp->private_data;
+
+	return simple_read_from_buffer(buf, count, ppos, report, strlen(report));
+}
+
+
+/**
+ * @brief Release the report of the harness
+ */
+static int stk11xx_sim_report_release(struct inode *inode, struct file *fp)
+{
+	kfree(fp->private_data);
+
+	return 0;
+}
+
+
+/**
+ * @brief Read the script of the simulators
+ */
+static ssize_t stk11xx_sim_script_read(struct file *fp, char __user *buf, size_t count, loff_t *ppos)
+{
+	int i;
+	int len = 0;
+	char str[STK11XX_SIM_RULES * 32];
+
+	mutex_lock(&stk11xx_sim_lock);
+
+	for (i=0; i<stk11xx_sim_nrules; i++)
+		len += scnprintf(str + len, sizeof(str) - len, "%04x %04x %u %02x\n",
+				stk11xx_sim_script[i].reg, stk11xx_sim_script[i].value,
+				stk11xx_sim_script[i].busy_us, stk11xx_sim_script[i].status);
+
+	mutex_unlock(&stk11xx_sim_lock);
+
+	return simple_read_from_buffer(buf, count, ppos, str, len);
+}
+
+
+/**
+ * @brief Replace the script of the simulators
+ *
+ * One rule by line : register, value (hexadecimal), length of the
+ * transaction (us), status at its end (hexadecimal).
+ */
+static ssize_t stk11xx_sim_script_write(struct file *fp, const char __user *buf, size_t count, loff_t *ppos)
+{
+	int n = 0;
+	char *str;
+	char *line;
+	char *next;
+	struct stk11xx_sim_rule rules[STK11XX_SIM_RULES];
+
+	if (count >= PAGE_SIZE)
+		return -EINVAL;
+
+	str = memdup_user_nul(buf, count);
+
+	if (IS_ERR(str))
+		return PTR_ERR(str);
+
+	for (next=str; (line = strsep(&next, "\n")) != NULL; ) {
+		if (*skip_spaces(line) == '\0')
+			continue;
+
+		if ((n == STK11XX_SIM_RULES) || (sscanf(line, "%hx %hx %u %hhx",
+					&rules[n].reg, &rules[n].value, &rules[n].busy_us, &rules[n].status) != 4)) {
+			kfree(str);
+			return -EINVAL;
+		}
+
+		n++;
+	}
+
+	kfree(str);
+
+	mutex_lock(&stk11xx_sim_lock);
+	memcpy(stk11xx_sim_script, rules, n * sizeof(rules[0]));
+	stk11xx_sim_nrules = n;
+	mutex_unlock(&stk11xx_sim_lock);
+
+	return count;
+}
+
+
+/**
+ * @var stk11xx_sim_report_fops
+ */
+static const struct file_operations stk11xx_sim_report_fops = {
+	.owner = THIS_MODULE,
+	.open = stk11xx_sim_report_open,
+	.read = stk11xx_sim_report_read,
+	.release = stk11xx_sim_report_release,
+};
+
+
+/**
+ * @var stk11xx_sim_script_fops
+ */
+static const struct file_operations stk11xx_sim_script_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = stk11xx_sim_script_read,
+	.write = stk11xx_sim_script_write,
+	.llseek = default_llseek,
+};
+
+
+/**
+ * @param root Directory of the driver in the debugfs
+ *
+ * @brief Create the entries of the simulator in the debugfs.
+ *   - simulate : runs the sequences of every model, and gives the report
+ *   - sim_script : the script of the simulators
+ */
+void stk11xx_sim_create_debugfs(struct dentry *root)
+{
+	debugfs_create_file("simulate", 0400, root, NULL, &stk11xx_sim_report_fops);
+	debugfs_create_file("sim_script", 0600, root, NULL, &stk11xx_sim_script_fops);
+}
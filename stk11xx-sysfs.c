@@ -90,10 +90,164 @@ static ssize_t show_videostatus(struct device *class, struct device_attribute *a
 	return sprintf(buf,
 			"Nbr ISOC errors    : %d\n"
 			"Nbr dropped frames : %d\n"
-			"Nbr dumped frames  : %d\n",
+			"Nbr dumped frames  : %d\n"
+			"Nbr camera resets  : %d\n"
+			"Nbr cold starts    : %d\n"
+			"Nbr warm starts    : %d\n"
+			"Error status       : %d\n",
 			dev->visoc_errors,
 			dev->vframes_error,
-			dev->vframes_dumped);
+			dev->vframes_dumped,
+			dev->watchdog_resets,
+			dev->cold_starts,
+			dev->warm_starts,
+			dev->error_status);
+}
+
+
+/** 
+ * @brief show_consumers
+ *
+ * @param class Class device
+ *
+ * @retval buf Adress of buffer with the 'consumers' value
+ * 
+ * @returns Size of buffer
+ *
+ * One line per opened file : the frames given to it and the frames it lost
+ * because it had no buffer queued.
+ */
+static ssize_t show_consumers(struct device *class, struct device_attribute *attr, char *buf)
+{
+	int i = 0;
+	ssize_t len = 0;
+	struct stk11xx_fh *fh;
+
+	struct video_device *vdev = to_video_device(class);
+	struct usb_stk11xx *dev = video_get_drvdata(vdev);
+
+	mutex_lock(&dev->fh_lock);
+
+	list_for_each_entry(fh, &dev->fh_list, list) {
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				"Consumer %d %s%s: %u frames, %u dropped\n",
+				i++,
+				fh->streaming ? "(streaming) " : "",
+				(fh == dev->owner) ? "(owner) " : "",
+				fh->frames_done,
+				fh->frames_dropped);
+	}
+
+	mutex_unlock(&dev->fh_lock);
+
+	return len;
+}
+
+
+/** 
+ * @brief show_startup
+ *
+ * @param class Class device
+ *
+ * @retval buf Adress of buffer with the 'startup' value
+ * 
+ * @returns Size of buffer
+ */
+static ssize_t show_startup(struct device *class, struct device_attribute *attr, char *buf)
+{
+	struct video_device *vdev = to_video_device(class);
+	struct usb_stk11xx *dev = video_get_drvdata(vdev);
+
+	if (!completion_done(&dev->init_done))
+		return sprintf(buf,
+				"Probe              : %u us\n"
+				"Initialization     : pending\n",
+				dev->probe_us);
+
+	return sprintf(buf,
+			"Probe              : %u us\n"
+			"Init. delay        : %u us\n"
+			"Initialization     : %u us\n"
+			"Ready after        : %u us\n"
+			"Init. status       : %d\n",
+			dev->probe_us,
+			dev->init_delay_us,
+			dev->init_us,
+			dev->init_delay_us + dev->init_us,
+			dev->init_error);
+}
+
+
+/** 
+ * @brief show_regcache
+ *
+ * @param class Class device
+ *
+ * @retval buf Adress of buffer with the 'regcache' value
+ * 
+ * @returns Size of buffer
+ */
+static ssize_t show_regcache(struct device *class, struct device_attribute *attr, char *buf)
+{
+	struct video_device *vdev = to_video_device(class);
+	struct usb_stk11xx *dev = video_get_drvdata(vdev);
+
+	return sprintf(buf,
+			"Known registers    : %d\n"
+			"Nbr writes saved   : %u\n"
+			"Nbr reads saved    : %u\n",
+			bitmap_weight(dev->reg_shadow_valid, STK11XX_REG_SHADOW),
+			dev->reg_writes_saved,
+			dev->reg_reads_saved);
+}
+
+
+/** 
+ * @brief show_polling
+ *
+ * @param class Class device
+ *
+ * @retval buf Adress of buffer with the 'polling' value
+ * 
+ * @returns Size of buffer
+ *
+ * One line per caller of the device check : the number of checks, the
+ * timeouts and errors, the total and longest waits, then the distribution
+ * of the waits.
+ */
+static ssize_t show_polling(struct device *class, struct device_attribute *attr, char *buf)
+{
+	int i, j;
+	ssize_t len = 0;
+	struct stk11xx_poll_stat *stat;
+
+	struct video_device *vdev = to_video_device(class);
+	struct usb_stk11xx *dev = video_get_drvdata(vdev);
+
+	len += scnprintf(buf + len, PAGE_SIZE - len,
+			"# site calls timeouts errors total_us max_us | <250us <500us <1ms <2ms <4ms <8ms <16ms >=16ms\n");
+
+	for (i=0; i<STK11XX_POLL_SITES; i++) {
+		stat = &dev->poll_stats[i];
+
+		if (stat->calls == 0)
+			continue;
+
+		if (stat->site)
+			len += scnprintf(buf + len, PAGE_SIZE - len, "%pS", stat->site);
+		else
+			len += scnprintf(buf + len, PAGE_SIZE - len, "others");
+
+		len += scnprintf(buf + len, PAGE_SIZE - len, " %u %u %u %lu %u |",
+				stat->calls, stat->timeouts, stat->errors, stat->total_us, stat->max_us);
+
+		for (j=0; j<STK11XX_POLL_BUCKETS; j++)
+			len += scnprintf(buf + len, PAGE_SIZE - len, " %u", stat->hist[j]);
+
+		len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+	}
+
+	return len;
 }
 
 
@@ -214,6 +368,56 @@ static ssize_t show_fps(struct device *class, struct device_attribute *attr, cha
 }
 
 
+/** 
+ * @brief show_watchdog
+ *
+ * @param class Class device
+ *
+ * @retval buf Adress of buffer with the 'watchdog' value
+ * 
+ * @returns Size of buffer
+ */
+static ssize_t show_watchdog(struct device *class, struct device_attribute *attr, char *buf)
+{
+	struct video_device *vdev = to_video_device(class);
+	struct usb_stk11xx *dev = video_get_drvdata(vdev);
+
+	return sprintf(buf, "%d\n", dev->watchdog_interval);
+}
+
+
+/** 
+ * @brief store_watchdog
+ *
+ * @param class Class device
+ * @param buf Buffer
+ * @param count Counter
+ *
+ * @returns Size of buffer
+ *
+ * The new interval is used from the next check, or from the next stream if
+ * the watchdog was off.
+ */
+static ssize_t store_watchdog(struct device *class, struct device_attribute *attr,
+		const char *buf, size_t count)
+{
+	char *endp;
+	unsigned long value;
+
+	struct video_device *vdev = to_video_device(class);
+	struct usb_stk11xx *dev = video_get_drvdata(vdev);
+
+	value = simple_strtoul(buf, &endp, 10);
+
+	if (endp == buf)
+		return -EINVAL;
+
+	dev->watchdog_interval = (int) value;
+
+	return strlen(buf);
+}
+
+
 /** 
  * @brief show_brightness
  *
@@ -487,7 +691,12 @@ static ssize_t store_vflip(struct device *class, struct device_attribute *attr,
 static DEVICE_ATTR(release, S_IRUGO, show_release, NULL);											/**< Release value */
 static DEVICE_ATTR(videostatus, S_IRUGO, show_videostatus, NULL);									/**< Video status */
 static DEVICE_ATTR(informations, S_IRUGO, show_informations, NULL);									/**< Informations */
+static DEVICE_ATTR(consumers, S_IRUGO, show_consumers, NULL);										/**< Consumers */
+static DEVICE_ATTR(startup, S_IRUGO, show_startup, NULL);											/**< Startup times */
+static DEVICE_ATTR(regcache, S_IRUGO, show_regcache, NULL);											/**< Register shadow */
+static DEVICE_ATTR(polling, S_IRUGO, show_polling, NULL);											/**< Device checks */
 static DEVICE_ATTR(fps, S_IRUGO, show_fps, NULL);													/**< FPS value */
+static DEVICE_ATTR(watchdog, 0660, show_watchdog, store_watchdog);						/**< Watchdog interval */
 static DEVICE_ATTR(brightness, 0660, show_brightness, store_brightness);				/**< Brightness value */
 static DEVICE_ATTR(contrast, 0660, show_contrast, store_contrast);						/**< Contrast value */
 static DEVICE_ATTR(whitebalance, 0660, show_whitebalance, store_whitebalance);			/**< Whitebalance value */
@@ -512,7 +721,12 @@ int stk11xx_create_sysfs_files(struct video_device *vdev)
 	ret = device_create_file(&vdev->dev, &dev_attr_release);
 	ret = device_create_file(&vdev->dev, &dev_attr_videostatus);
 	ret = device_create_file(&vdev->dev, &dev_attr_informations);
+	ret = device_create_file(&vdev->dev, &dev_attr_consumers);
+	ret = device_create_file(&vdev->dev, &dev_attr_startup);
+	ret = device_create_file(&vdev->dev, &dev_attr_regcache);
+	ret = device_create_file(&vdev->dev, &dev_attr_polling);
 	ret = device_create_file(&vdev->dev, &dev_attr_fps);
+	ret = device_create_file(&vdev->dev, &dev_attr_watchdog);
 	ret = device_create_file(&vdev->dev, &dev_attr_brightness);
 	ret = device_create_file(&vdev->dev, &dev_attr_contrast);
 	ret = device_create_file(&vdev->dev, &dev_attr_whitebalance);
@@ -538,7 +752,12 @@ void stk11xx_remove_sysfs_files(struct video_device *vdev)
 	device_remove_file(&vdev->dev, &dev_attr_release);
 	device_remove_file(&vdev->dev, &dev_attr_videostatus);
 	device_remove_file(&vdev->dev, &dev_attr_informations);
+	device_remove_file(&vdev->dev, &dev_attr_consumers);
+	device_remove_file(&vdev->dev, &dev_attr_startup);
+	device_remove_file(&vdev->dev, &dev_attr_regcache);
+	device_remove_file(&vdev->dev, &dev_attr_polling);
 	device_remove_file(&vdev->dev, &dev_attr_fps);
+	device_remove_file(&vdev->dev, &dev_attr_watchdog);
 	device_remove_file(&vdev->dev, &dev_attr_brightness);
 	device_remove_file(&vdev->dev, &dev_attr_contrast);
 	device_remove_file(&vdev->dev, &dev_attr_whitebalance);
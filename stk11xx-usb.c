@@ -95,6 +95,12 @@ static int default_colour = -1;
  */
 static int default_norm = -1;
 
+/**
+ * @var default_watchdog
+ *   Time between two checks of the camera (ms)
+ */
+static int default_watchdog = STK11XX_WATCHDOG_INTERVAL;
+
  
 /**
  * @var stk11xx_table
@@ -143,35 +149,35 @@ int usb_stk11xx_isoc_init(struct usb_stk11xx *dev)
 	if (dev->isoc_init_ok)
 		return 0;
 
+	// The virtual camera plays its recording instead
+	if (dev->replay != NULL) {
+		ret = stk11xx_replay_start(dev);
+
+		if (ret == 0)
+			dev->isoc_init_ok = 1;
+
+		return ret;
+	}
+
 	udev = dev->udev;
 
 	STK_DEBUG("usb_stk11xx_isoc_init()\n");
 
-	// Allocate URB structure
+	// Allocate URB structure (kept in the buffer pool between two streams)
 	for (i=0; i<MAX_ISO_BUFS; i++) {
+		if (dev->isobuf[i].urb != NULL)
+			continue;
+
 		urb = usb_alloc_urb(ISO_FRAMES_PER_DESC, GFP_KERNEL);
 
 		if (urb == NULL) {
 			STK_ERROR("Failed to allocate URB %d\n", i);
-			ret = -ENOMEM;
-			break;
+			return -ENOMEM;
 		}
 
 		dev->isobuf[i].urb = urb;
 	}
 
-	if (ret) {
-		while (i >= 0) {
-			if (dev->isobuf[i].urb != NULL)
-				usb_free_urb(dev->isobuf[i].urb);
-
-			dev->isobuf[i].urb = NULL;
-			i--;
-		}
-
-		return ret;
-	}
-
 	// Init URB structure
 	for (i=0; i<MAX_ISO_BUFS; i++) {
 		urb = dev->isobuf[i].urb;
@@ -241,44 +247,32 @@ int usb_stk11xx_isoc_init(struct usb_stk11xx *dev)
 
 
 /** 
- * @param urb URB structure
+ * @param dev Device structure
+ * @param urb Completed isoc URB
  *
- * @brief ISOC handler
+ * @brief Reassemble the frames from the packets of an isoc URB
  *
- * This function is called as an URB transfert is complete (Isochronous pipe).
- * So, the traitement is done in interrupt time, so it has be fast, not crash,
- * ans not stall. Neat.
+ * The packets are appended to the frame being filled, and the completed
+ * frames are given to the conversion. The URB isn't re-submitted here : the
+ * virtual camera (see stk11xx-replay.c) gives its recorded URBs too.
  */
-void usb_stk11xx_isoc_handler(struct urb *urb)
+void usb_stk11xx_isoc_packets(struct usb_stk11xx *dev, struct urb *urb)
 {
 	int i;
-	int ret;
 	int skip;
 
 	int awake = 0;
 	int framestatus;
 	int framelen;
 
+	u64 now;
+	u64 period;
+
 	unsigned char *fill = NULL;
 	unsigned char *iso_buf = NULL;
 
-	struct usb_stk11xx *dev;
 	struct stk11xx_frame_buf *framebuf;
 
-	STK_STREAM("Isoc handler\n");
-
-	dev = (struct usb_stk11xx *) urb->context;
-
-	if (dev == NULL) {
-		STK_ERROR("isoc_handler called with NULL device !\n");
-		return;
-	}
-
-	if (urb->status == -ENOENT || urb->status == -ECONNRESET) {
-		STK_DEBUG("URB unlinked synchronuously !\n");
-		return;
-	}
-
 	if (urb->status != -EINPROGRESS && urb->status != 0) {
 		const char *errmsg;
 
@@ -314,15 +308,6 @@ void usb_stk11xx_isoc_handler(struct urb *urb)
 
 		dev->visoc_errors++;
 
-		wake_up_interruptible(&dev->wait_frame);
-
-		urb->dev = dev->udev;
-		ret = usb_submit_urb(urb, GFP_ATOMIC);
-
-		if (ret != 0) {
-			STK_ERROR("Error (%d) re-submitting urb in stk11xx_isoc_handler.\n", ret);
-		}
-
 		return;
 	}
 
@@ -330,16 +315,6 @@ void usb_stk11xx_isoc_handler(struct urb *urb)
 
 	if (framebuf == NULL) {
 		STK_ERROR("isoc_handler without valid fill frame !\n");
-		
-		wake_up_interruptible(&dev->wait_frame);
-
-		urb->dev = dev->udev;
-		ret = usb_submit_urb(urb, GFP_ATOMIC);
-
-		if (ret != 0) {
-			STK_ERROR("Error (%d) re-submitting urb in stk11xx_isoc_handler.\n", ret);
-		}
-
 		return;
 	}
 	else {
@@ -349,6 +324,10 @@ void usb_stk11xx_isoc_handler(struct urb *urb)
 	// Reset ISOC error counter
 	dev->visoc_errors = 0;
 
+	// The packets are received once per (micro)frame, the last one just now
+	now = ktime_get_ns();
+	period = (dev->speed == USB_SPEED_HIGH) ? 125000 : 1000000;
+
 	// Compact data
 	for (i=0; i<urb->number_of_packets; i++) {
 		framestatus = urb->iso_frame_desc[i].status;
@@ -371,6 +350,10 @@ void usb_stk11xx_isoc_handler(struct urb *urb)
 					skip = 8;
 				}
 
+				// First packet of the frame
+				if (framebuf->filled == 0)
+					framebuf->timestamp = now - (urb->number_of_packets - 1 - i) * period;
+
 				// Determine if odd or even frame, and set a flag
 				if (framelen == 8) {
 					if (*iso_buf & 0x40)
@@ -405,13 +388,19 @@ void usb_stk11xx_isoc_handler(struct urb *urb)
 					if (framebuf->filled < dev->frame_size)
 						framebuf->errors++;
 
-					// If there are errors, we skip a frame...
-					if (framebuf->errors == 0) {
-						if (stk11xx_next_frame(dev))
-							dev->vframes_dumped++;
+					// Skip the frames above the frame rate wished, they aren't numbered
+					if (stk11xx_frame_wanted(dev, framebuf)) {
+						// Each frame gets a number, even if it's dropped
+						framebuf->sequence = dev->frame_sequence++;
+
+						// If there are errors, we skip a frame...
+						if (framebuf->errors == 0) {
+							if (stk11xx_next_frame(dev))
+								dev->vframes_dumped++;
+						}
+						else
+							dev->vframes_error++;
 					}
-					else
-						dev->vframes_error++;
 
 					awake = 1;
 					framebuf = dev->fill_frame;
@@ -426,8 +415,44 @@ void usb_stk11xx_isoc_handler(struct urb *urb)
 		}
 	}
 
+	// Convert the completed frames
 	if (awake == 1)
-		wake_up_interruptible(&dev->wait_frame);
+		schedule_work(&dev->frame_work);
+}
+
+
+/** 
+ * @param urb URB structure
+ *
+ * @brief ISOC handler
+ *
+ * This function is called as an URB transfert is complete (Isochronous pipe).
+ * So, the traitement is done in interrupt time, so it has be fast, not crash,
+ * ans not stall. Neat.
+ */
+void usb_stk11xx_isoc_handler(struct urb *urb)
+{
+	int ret;
+
+	struct usb_stk11xx *dev;
+
+	STK_STREAM("Isoc handler\n");
+
+	dev = (struct usb_stk11xx *) urb->context;
+
+	if (dev == NULL) {
+		STK_ERROR("isoc_handler called with NULL device !\n");
+		return;
+	}
+
+	if (urb->status == -ENOENT || urb->status == -ECONNRESET) {
+		STK_DEBUG("URB unlinked synchronuously !\n");
+		return;
+	}
+
+	stk11xx_record_urb(dev, urb);
+
+	usb_stk11xx_isoc_packets(dev, urb);
 
 	urb->dev = dev->udev;
 
@@ -444,7 +469,8 @@ void usb_stk11xx_isoc_handler(struct urb *urb)
  *
  * @brief Clean-up all the ISOC buffers
  *
- * This function permits to clean-up all the ISOC buffers.
+ * This function permits to clean-up all the ISOC buffers. The URBs are only
+ * killed, they are released with the buffer pool.
  */
 void usb_stk11xx_isoc_cleanup(struct usb_stk11xx *dev)
 {
@@ -458,19 +484,20 @@ void usb_stk11xx_isoc_cleanup(struct usb_stk11xx *dev)
 	if (dev->isoc_init_ok == 0)
 		return;
 
+	if (dev->replay != NULL) {
+		stk11xx_replay_stop(dev);
+		dev->isoc_init_ok = 0;
+		return;
+	}
+
 	// Unlinking ISOC buffers
 	for (i=0; i<MAX_ISO_BUFS; i++) {
 		struct urb *urb;
 
 		urb = dev->isobuf[i].urb;
 
-		if (urb != 0) {
-			if (dev->isoc_init_ok)
-				usb_kill_urb(urb);
-			
-			usb_free_urb(urb);
-			dev->isobuf[i].urb = NULL;
-		}
+		if (urb != 0)
+			usb_kill_urb(urb);
 	}
 
 	// All is done
@@ -492,16 +519,10 @@ void usb_stk11xx_isoc_cleanup(struct usb_stk11xx *dev)
 int usb_stk11xx_set_feature(struct usb_stk11xx *dev, int index)
 {
 	int result;
-	struct usb_device *udev = dev->udev;
 
-	result = usb_control_msg(udev, usb_sndctrlpipe(udev, 0),
-			USB_REQ_SET_FEATURE,
-			USB_TYPE_STANDARD | USB_DIR_OUT | USB_RECIP_DEVICE,
-			USB_DEVICE_REMOTE_WAKEUP,
-			index,
-			NULL,
-			0,
-			500);
+	usb_stk11xx_wait_registry(dev);
+
+	result = dev->bus->set_feature(dev, index);
 	
 	if (result < 0)
 		STK_ERROR("SET FEATURE fail !\n");
@@ -524,42 +545,223 @@ int usb_stk11xx_set_feature(struct usb_stk11xx *dev, int index)
 int usb_stk11xx_set_configuration(struct usb_stk11xx *dev)
 {
 	int result;
-	struct usb_device *udev = dev->udev;
 
-	result = usb_control_msg(udev, usb_sndctrlpipe(udev, 0),
-			USB_REQ_SET_CONFIGURATION,
-			USB_TYPE_STANDARD | USB_DIR_OUT | USB_RECIP_DEVICE,
-			0,
-			udev->config[0].desc.bConfigurationValue,
-			NULL,
-			0,
-			500);
+	usb_stk11xx_wait_registry(dev);
+
+	// The device is reset
+	usb_stk11xx_invalidate_registry(dev);
+
+	result = dev->bus->set_configuration(dev);
 
 	if (result < 0)
 		STK_ERROR("SET CONFIGURATION fail !\n");
 	else 
-		STK_DEBUG("SET CONFIGURATION %d\n", udev->config[0].desc.bConfigurationValue);
+		STK_DEBUG("SET CONFIGURATION\n");
 
 	return result;
 }
 
 
+/** 
+ * @param index Register
+ * 
+ * @returns Not zero if the register is kept in the shadow
+ *
+ * @brief Registers of the shadow.
+ *
+ * Only the plain registers of the bridge are shadowed : reading them gives the
+ * last value written. The GPIO (0x0000, 0x0001), the stream control (0x0100),
+ * the serial bus strobe, status and data (0x0200, 0x0201, 0x0204-0x0209) and
+ * the registers of the 0408 are always sent to the device.
+ */
+static int usb_stk11xx_shadowed(__u16 index)
+{
+	switch (index) {
+		case 0x0002:
+		case 0x0003:
+		case 0x0005:
+		case 0x0007:
+		case 0x000d:
+		case 0x000f:
+		case 0x0018 ... 0x001c:
+		case 0x0103 ... 0x0117:
+		case 0x0202:
+		case 0x0203:
+		case 0x02ff:
+		case 0x0300:
+		case 0x0350 ... 0x0353:
+			return 1;
+	}
+
+	return 0;
+}
+
+
+/** 
+ * @param dev Device structure
+ * @param index Register
+ * 
+ * @returns Not zero if the shadow knows the value of the register
+ */
+static int usb_stk11xx_shadow_known(struct usb_stk11xx *dev, __u16 index)
+{
+	// A queued write failed : the shadow isn't trusted until the end of the sequence
+	if (READ_ONCE(dev->reg_error))
+		return 0;
+
+	return usb_stk11xx_shadowed(index) && test_bit(index, dev->reg_shadow_valid);
+}
+
+
+/** 
+ * @param dev Device structure
+ * @param index Register
+ * @param value Value sent to or read from the device
+ */
+static void usb_stk11xx_shadow_store(struct usb_stk11xx *dev, __u16 index, int value)
+{
+	if (!usb_stk11xx_shadowed(index))
+		return;
+
+	if ((value < 0) || (value > 0xff)) {
+		clear_bit(index, dev->reg_shadow_valid);
+		return;
+	}
+
+	dev->reg_shadow[index] = value;
+	set_bit(index, dev->reg_shadow_valid);
+}
+
+
+/** 
+ * @param dev Device structure
+ *
+ * @brief Forget the values of the shadow.
+ *
+ * Called when the registers may have changed behind the driver : a reset, a
+ * suspend, a failed write.
+ */
+void usb_stk11xx_invalidate_registry(struct usb_stk11xx *dev)
+{
+	bitmap_zero(dev->reg_shadow_valid, STK11XX_REG_SHADOW);
+
+	// Neither the configuration of the camera is known
+	dev->warm = 0;
+}
+
+
+/** 
+ * @param urb URB of a register write
+ *
+ * @brief Completion of a queued register write.
+ */
+static void usb_stk11xx_write_complete(struct urb *urb)
+{
+	struct usb_stk11xx *dev = urb->context;
+	struct usb_ctrlrequest *req = (struct usb_ctrlrequest *) urb->setup_packet;
+
+	if (urb->status < 0) {
+		STK_ERROR("Write registry fails %02X = %02X", le16_to_cpu(req->wIndex), le16_to_cpu(req->wValue));
+
+		// Keep the first error for usb_stk11xx_end_registry
+		cmpxchg(&dev->reg_error, 0, urb->status);
+	}
+
+	kfree(req);
+
+	atomic_dec(&dev->reg_inflight);
+	wake_up(&dev->reg_wait);
+}
+
+
 /** 
  * @param dev 
  * @param index 
  * @param value 
  * 
+ * @returns 0 if the write is queued
+ *
+ * @brief Queue a register write
+ *
+ * The control URB is submitted without waiting for its completion. The URBs
+ * of the endpoint 0 are completed in order, so the writes keep the order of
+ * the sequence.
+ */
+static int usb_stk11xx_write_async(struct usb_stk11xx *dev, __u16 index, __u16 value)
+{
+	int result;
+	struct urb *urb;
+	struct usb_ctrlrequest *req;
+	struct usb_device *udev = dev->udev;
+
+	// Only a few writes in flight
+	if (!wait_event_timeout(dev->reg_wait, atomic_read(&dev->reg_inflight) < STK11XX_REG_INFLIGHT,
+				msecs_to_jiffies(STK11XX_REG_TIMEOUT))) {
+		STK_ERROR("Write registry timeout %02X = %02X", index, value);
+		return -ETIMEDOUT;
+	}
+
+	urb = usb_alloc_urb(0, GFP_KERNEL);
+
+	if (urb == NULL)
+		return -ENOMEM;
+
+	req = kmalloc(sizeof(struct usb_ctrlrequest), GFP_KERNEL);
+
+	if (req == NULL) {
+		usb_free_urb(urb);
+		return -ENOMEM;
+	}
+
+	req->bRequestType = USB_DIR_OUT | USB_TYPE_VENDOR | USB_RECIP_DEVICE;
+	req->bRequest = 0x01;
+	req->wValue = cpu_to_le16(value);
+	req->wIndex = cpu_to_le16(index);
+	req->wLength = 0;
+
+	usb_fill_control_urb(urb, udev, usb_sndctrlpipe(udev, 0),
+			(unsigned char *) req, NULL, 0,
+			usb_stk11xx_write_complete, dev);
+
+	usb_anchor_urb(urb, &dev->reg_anchor);
+	atomic_inc(&dev->reg_inflight);
+
+	result = usb_submit_urb(urb, GFP_KERNEL);
+
+	if (result < 0) {
+		STK_ERROR("Write registry fails %02X = %02X", index, value);
+
+		usb_unanchor_urb(urb);
+		atomic_dec(&dev->reg_inflight);
+		kfree(req);
+	}
+
+	// The anchor keeps the URB until its completion
+	usb_free_urb(urb);
+
+	return result;
+}
+
+
+/** 
+ * @param dev Device structure
+ * @param index Register
+ * @param value Value
+ * 
  * @returns 0 if all is OK
  *
- * @brief Write a 16-bits value to a 16-bits register
+ * @brief Write a register of a USB camera
  *
- * This function permits to write a 16-bits value to a 16-bits register on the USB bus.
+ * Inside a sequence (see usb_stk11xx_begin_registry), the write is only queued.
  */
-int usb_stk11xx_write_registry(struct usb_stk11xx *dev, __u16 index, __u16 value)
+static int usb_stk11xx_bus_write(struct usb_stk11xx *dev, __u16 index, __u16 value)
 {
 	int result;
 	struct usb_device *udev = dev->udev;
 
+	if (dev->reg_batch)
+		return usb_stk11xx_write_async(dev, index, value);
+
 	result = usb_control_msg(udev, usb_sndctrlpipe(udev, 0),
 			0x01,
 			USB_DIR_OUT | USB_TYPE_VENDOR | USB_RECIP_DEVICE,
@@ -569,8 +771,232 @@ int usb_stk11xx_write_registry(struct usb_stk11xx *dev, __u16 index, __u16 value
 			0,
 			500);
 
-	if (result < 0)
-		STK_ERROR("Write registry fails %02X = %02X", index, value);
+	if (result < 0)
+		STK_ERROR("Write registry fails %02X = %02X", index, value);
+
+	return result;
+}
+
+
+/** 
+ * @param dev Device structure
+ * @param index Register
+ * @param value Value read
+ * 
+ * @returns Bytes read, or a negative error
+ *
+ * @brief Read a register of a USB camera
+ */
+static int usb_stk11xx_bus_read(struct usb_stk11xx *dev, __u16 index, int *value)
+{
+	int result;
+	struct usb_device *udev = dev->udev;
+
+	result = usb_control_msg(udev, usb_rcvctrlpipe(udev, 0),
+			0x00,
+			USB_DIR_IN | USB_TYPE_VENDOR | USB_RECIP_DEVICE,
+			0x00,
+			index,
+			(__u8 *) value,
+			sizeof(__u8),
+			500);
+
+	if (result < 0)
+		STK_ERROR("Read registry fails %02X", index);
+
+	return result;
+}
+
+
+/** 
+ * @param dev Device structure
+ * @param alternate Alternate setting of the interface '0'
+ * 
+ * @returns 0 if all is OK
+ */
+static int usb_stk11xx_bus_set_interface(struct usb_stk11xx *dev, int alternate)
+{
+	return usb_set_interface(dev->udev, 0, alternate);
+}
+
+
+/** 
+ * @param dev Device structure
+ * @param index Choice of the interface
+ * 
+ * @returns 0 if all is OK
+ */
+static int usb_stk11xx_bus_set_feature(struct usb_stk11xx *dev, int index)
+{
+	struct usb_device *udev = dev->udev;
+
+	return usb_control_msg(udev, usb_sndctrlpipe(udev, 0),
+			USB_REQ_SET_FEATURE,
+			USB_TYPE_STANDARD | USB_DIR_OUT | USB_RECIP_DEVICE,
+			USB_DEVICE_REMOTE_WAKEUP,
+			index,
+			NULL,
+			0,
+			500);
+}
+
+
+/** 
+ * @param dev Device structure
+ * 
+ * @returns 0 if all is OK
+ */
+static int usb_stk11xx_bus_set_configuration(struct usb_stk11xx *dev)
+{
+	struct usb_device *udev = dev->udev;
+
+	return usb_control_msg(udev, usb_sndctrlpipe(udev, 0),
+			USB_REQ_SET_CONFIGURATION,
+			USB_TYPE_STANDARD | USB_DIR_OUT | USB_RECIP_DEVICE,
+			0,
+			udev->config[0].desc.bConfigurationValue,
+			NULL,
+			0,
+			500);
+}
+
+
+/**
+ * @var usb_stk11xx_bus_ops
+ *
+ * Transfers of a USB camera
+ */
+const struct stk11xx_bus_ops usb_stk11xx_bus_ops = {
+	.write = usb_stk11xx_bus_write,
+	.read = usb_stk11xx_bus_read,
+	.set_interface = usb_stk11xx_bus_set_interface,
+	.set_feature = usb_stk11xx_bus_set_feature,
+	.set_configuration = usb_stk11xx_bus_set_configuration,
+};
+
+
+/** 
+ * @param dev Device structure
+ * @param alternate Alternate setting of the interface '0'
+ * 
+ * @returns 0 if all is OK
+ *
+ * @brief Choose the alternate setting of the video interface
+ */
+int usb_stk11xx_set_interface(struct usb_stk11xx *dev, int alternate)
+{
+	int ret;
+
+	usb_stk11xx_wait_registry(dev);
+
+	ret = dev->bus->set_interface(dev, alternate);
+
+	if (ret < 0)
+		STK_ERROR("usb_set_interface failed !\n");
+
+	return ret;
+}
+
+
+/** 
+ * @param dev Device structure
+ *
+ * @brief Wait for the queued register writes.
+ *
+ * This is the barrier of the register sequences : it's called before a read,
+ * a delay or a change of the interface, which depend on the previous writes.
+ */
+void usb_stk11xx_wait_registry(struct usb_stk11xx *dev)
+{
+	if (atomic_read(&dev->reg_inflight) == 0)
+		return;
+
+	if (!wait_event_timeout(dev->reg_wait, atomic_read(&dev->reg_inflight) == 0,
+				msecs_to_jiffies(STK11XX_REG_TIMEOUT))) {
+		STK_ERROR("Registry writes timeout !\n");
+		usb_stk11xx_kill_registry(dev);
+		usb_stk11xx_invalidate_registry(dev);
+	}
+}
+
+
+/** 
+ * @param dev Device structure
+ *
+ * @brief Cancel the queued register writes.
+ */
+void usb_stk11xx_kill_registry(struct usb_stk11xx *dev)
+{
+	usb_kill_anchored_urbs(&dev->reg_anchor);
+}
+
+
+/** 
+ * @param dev Device structure
+ *
+ * @brief Start a sequence of register writes.
+ *
+ * Until usb_stk11xx_end_registry, the register writes are queued as
+ * asynchronous control URBs, so the long initialization sequences don't wait
+ * for each write. The sequences can be nested.
+ */
+void usb_stk11xx_begin_registry(struct usb_stk11xx *dev)
+{
+	dev->reg_batch++;
+}
+
+
+/** 
+ * @param dev Device structure
+ * 
+ * @returns 0 if all the writes of the sequence succeeded
+ *
+ * @brief End a sequence of register writes.
+ */
+int usb_stk11xx_end_registry(struct usb_stk11xx *dev)
+{
+	int err;
+
+	if (--dev->reg_batch > 0)
+		return 0;
+
+	usb_stk11xx_wait_registry(dev);
+
+	err = xchg(&dev->reg_error, 0);
+
+	// We don't know which write failed
+	if (err)
+		usb_stk11xx_invalidate_registry(dev);
+
+	return err;
+}
+
+
+/** 
+ * @param dev 
+ * @param index 
+ * @param value 
+ * 
+ * @returns 0 if all is OK
+ *
+ * @brief Write a 16-bits value to a 16-bits register
+ *
+ * This function permits to write a 16-bits value to a 16-bits register on the USB bus.
+ * Inside a sequence (see usb_stk11xx_begin_registry), the write is only queued.
+ * A write which doesn't change a shadowed register is elided.
+ */
+int usb_stk11xx_write_registry(struct usb_stk11xx *dev, __u16 index, __u16 value)
+{
+	int result;
+
+	if (usb_stk11xx_shadow_known(dev, index) && (dev->reg_shadow[index] == value)) {
+		dev->reg_writes_saved++;
+		return 0;
+	}
+
+	result = dev->bus->write(dev, index, value);
+
+	usb_stk11xx_shadow_store(dev, index, (result < 0) ? -1 : value);
 
 	return result;
 }
@@ -586,26 +1012,26 @@ int usb_stk11xx_write_registry(struct usb_stk11xx *dev, __u16 index, __u16 value
  * @brief Read a 16-bits value from a 16-bits register
  *
  * This function permits to read a 16-bits value from a 16-bits register on the USB bus.
+ * A shadowed register is read from the shadow.
  */
 int usb_stk11xx_read_registry(struct usb_stk11xx *dev, __u16 index, int *value)
 {
 	int result;
 
-	struct usb_device *udev = dev->udev;
+	if (usb_stk11xx_shadow_known(dev, index)) {
+		*value = dev->reg_shadow[index];
+		dev->reg_reads_saved++;
+		return sizeof(__u8);
+	}
 
 	*value = 0;
 
-	result = usb_control_msg(udev, usb_rcvctrlpipe(udev, 0),
-			0x00,
-			USB_DIR_IN | USB_TYPE_VENDOR | USB_RECIP_DEVICE,
-			0x00,
-			index,
-			(__u8 *) value,
-			sizeof(__u8),
-			500);
+	// The value may depend on the writes in flight
+	usb_stk11xx_wait_registry(dev);
 
-	if (result < 0)
-		STK_ERROR("Read registry fails %02X", index);
+	result = dev->bus->read(dev, index, value);
+
+	usb_stk11xx_shadow_store(dev, index, (result < 0) ? -1 : *value);
 
 	return result;
 }
@@ -621,7 +1047,7 @@ int usb_stk11xx_read_registry(struct usb_stk11xx *dev, __u16 index, int *value)
  * This function permits to set the video settings for each video camera model.
  * 
  */
-static int usb_stk11xx_default_settings(struct usb_stk11xx *dev)
+int usb_stk11xx_default_settings(struct usb_stk11xx *dev)
 {
 	switch (dev->webcam_model) {
 		case SYNTEK_STK_0408:
@@ -691,6 +1117,13 @@ static int usb_stk11xx_default_settings(struct usb_stk11xx *dev)
 			return -1;
 	}
 
+	// Without the module option, a sensor whose frame rate isn't programmed runs at full rate
+	if ((default_fps == -1) && (dev->webcam_model != SYNTEK_STK_A311) && (dev->webcam_model != SYNTEK_STK_M811))
+		dev->frame_rate = 0;
+	else
+		dev->frame_rate = dev->vsettings.fps;
+	dev->watchdog_interval = default_watchdog;
+
 	dev->vsettings.default_brightness = dev->vsettings.brightness;
 	dev->vsettings.default_whiteness = dev->vsettings.whiteness;
 	dev->vsettings.default_contrast = dev->vsettings.contrast;
@@ -702,6 +1135,229 @@ static int usb_stk11xx_default_settings(struct usb_stk11xx *dev)
 }
 
 
+/** 
+ * @param dev Device structure
+ * 
+ * @returns 0 if all is OK
+ *
+ * @brief Initialize the camera and keep the result for the opens.
+ *
+ * A failed initialization gives -EIO, whatever the failed transfer said :
+ * -ENODEV is kept for a camera which is gone (see usb_stk11xx_unregister).
+ * dev->modlock must be held.
+ */
+int usb_stk11xx_initialize(struct usb_stk11xx *dev)
+{
+	int err;
+
+	err = dev_stk11xx_initialize_device(dev);
+
+	if (err)
+		STK_ERROR("Failed to initialize the camera (%d) !\n", err);
+
+	dev->init_error = err ? -EIO : 0;
+
+	return dev->init_error;
+}
+
+
+/** 
+ * @param work Initialization work of the device
+ *
+ * @brief Initialize the device, out of the probe.
+ *
+ * The initialization is hundreds of control transfers : done here, the
+ * devices are initialized side by side and the USB enumeration goes on.
+ */
+static void usb_stk11xx_init_work(struct work_struct *work)
+{
+	ktime_t start;
+	struct usb_stk11xx *dev = container_of(work, struct usb_stk11xx, init_work);
+
+	start = ktime_get();
+	dev->init_delay_us = ktime_us_delta(start, dev->probe_time);
+
+	mutex_lock(&dev->modlock);
+	usb_stk11xx_initialize(dev);
+	mutex_unlock(&dev->modlock);
+
+	dev->init_us = ktime_us_delta(ktime_get(), start);
+
+	if (!dev->init_error)
+		STK_INFO("Camera initialized in %u us\n", dev->init_us);
+
+	complete_all(&dev->init_done);
+}
+
+
+/** 
+ * @param webcam_model Model of the camera
+ * @param webcam_type Type of the camera
+ * 
+ * @returns The device structure, NULL if out of memory
+ *
+ * @brief Allocate the structure of a device
+ *
+ * The mutexes, locks and works which don't depend on the bus are initialized.
+ */
+struct usb_stk11xx * usb_stk11xx_alloc(int webcam_model, int webcam_type)
+{
+	struct usb_stk11xx *dev;
+
+	dev = kzalloc(sizeof(struct usb_stk11xx), GFP_KERNEL);
+
+	if (dev == NULL) {
+		STK_ERROR("Out of memory !\n");
+		return NULL;
+	}
+
+	// Init mutexes, spinlock, etc.
+
+#ifndef init_MUTEX
+	sema_init(&dev->mutex,1);
+#else
+	init_MUTEX(&dev->mutex);
+#endif
+	mutex_init(&dev->modlock);
+	spin_lock_init(&dev->spinlock);
+
+	dev->probe_time = ktime_get();
+	INIT_WORK(&dev->init_work, usb_stk11xx_init_work);
+	init_completion(&dev->init_done);
+
+	atomic_set(&dev->reg_inflight, 0);
+	init_waitqueue_head(&dev->reg_wait);
+	init_usb_anchor(&dev->reg_anchor);
+
+	dev->webcam_model = webcam_model;
+	dev->webcam_type = webcam_type;
+
+	return dev;
+}
+
+
+/** 
+ * @param dev Device structure
+ * 
+ * @returns 0 if all is OK
+ *
+ * @brief Register the video device of a camera
+ *
+ * The camera is found (USB or virtual) : its video device, its buffers and
+ * its entries are created, and its initialization is started. On error,
+ * the caller only frees the structure.
+ */
+int usb_stk11xx_register(struct usb_stk11xx *dev)
+{
+	int err;
+
+	// Initialize the video device
+	dev->vdev = video_device_alloc();
+
+	if (!dev->vdev)
+		return -ENOMEM;
+
+	// The buffers are allocated at the first open and kept until disconnect
+	err = stk11xx_register_buffer_pool(dev);
+
+	if (err) {
+		video_device_release(dev->vdev);
+		return err;
+	}
+
+	// Each opened file gets its own capture queue
+	stk11xx_init_consumers(dev);
+
+	dev_stk11xx_init_watchdog(dev);
+	dev_stk11xx_init_sleep(dev);
+
+	// Register the video device
+	err = v4l_stk11xx_register_video_device(dev);
+
+	if (err) {
+		stk11xx_unregister_buffer_pool(dev);
+		return err;
+	}
+
+	// Create the entries in the sys filesystem
+	stk11xx_create_sysfs_files(dev->vdev);
+
+	// And in the debugfs
+	stk11xx_create_debugfs(dev);
+
+	// Default settings video device
+	usb_stk11xx_default_settings(dev);
+	
+	// Enable power management feature
+//	usb_autopm_enable(dev->interface);
+
+	dev->probe_us = ktime_us_delta(ktime_get(), dev->probe_time);
+
+	// Initialize the camera (the opens wait for it)
+	queue_work(system_long_wq, &dev->init_work);
+
+	return 0;
+}
+
+
+/** 
+ * @param dev Device structure
+ *
+ * @brief Unregister the video device of a camera
+ *
+ * The camera is gone : the waiting processes are alerted, and the function
+ * returns when the device is closed and nothing uses it any more.
+ */
+void usb_stk11xx_unregister(struct usb_stk11xx *dev)
+{
+	struct stk11xx_fh *fh;
+
+	// An initialization not started yet is useless, and no open may wait for it
+	cancel_work_sync(&dev->init_work);
+
+	// The next opens fail, none tries to initialize the camera again
+	mutex_lock(&dev->modlock);
+	dev->init_error = -ENODEV;
+	mutex_unlock(&dev->modlock);
+	complete_all(&dev->init_done);
+
+	// We got unplugged; this is signalled by an EPIPE error code
+	if (dev->vopen) {
+		STK_INFO("Disconnected while webcam is in use !\n");
+		dev->error_status = EPIPE;
+	}
+
+	// Alert waiting processes
+	mutex_lock(&dev->fh_lock);
+	list_for_each_entry(fh, &dev->fh_list, list)
+		vb2_queue_error(&fh->vb_queue);
+	mutex_unlock(&dev->fh_lock);
+
+	// Wait until device is closed
+	while (dev->vopen)
+		schedule();
+
+	// Remove the entries in the sys filesystem
+	stk11xx_remove_sysfs_files(dev->vdev);
+	stk11xx_remove_debugfs(dev);
+
+	// Unregister the video device
+	v4l_stk11xx_unregister_video_device(dev);
+
+	// No frame can be converted any more
+	cancel_work_sync(&dev->frame_work);
+	cancel_delayed_work_sync(&dev->watchdog_work);
+	cancel_delayed_work_sync(&dev->sleep_work);
+
+	// No register write may stay in flight
+	usb_stk11xx_kill_registry(dev);
+	usb_stk11xx_invalidate_registry(dev);
+
+	// Release the buffer pool
+	stk11xx_unregister_buffer_pool(dev);
+}
+
+
 /** 
  * @param interface 
  * @param id 
@@ -843,29 +1499,17 @@ static int usb_stk11xx_probe(struct usb_interface *interface, const struct usb_d
 		return -ENODEV;
 
 	// Allocate structure, initialize pointers, mutexes, etc. and link it to the usb_device
-	dev = kzalloc(sizeof(struct usb_stk11xx), GFP_KERNEL);
+	dev = usb_stk11xx_alloc(webcam_model, webcam_type);
 
-	if (dev == NULL) {
-		STK_ERROR("Out of memory !\n");
+	if (dev == NULL)
 		return -ENOMEM;
-	}
-
-	// Init mutexes, spinlock, etc.
-
-#ifndef init_MUTEX
-	sema_init(&dev->mutex,1);
-#else
-	init_MUTEX(&dev->mutex);
-#endif
-	mutex_init(&dev->modlock);
-	spin_lock_init(&dev->spinlock);
-	init_waitqueue_head(&dev->wait_frame);
 
 	// Save pointers
-	dev->webcam_model = webcam_model;
-	dev->webcam_type = webcam_type;
+	dev->bus = &usb_stk11xx_bus_ops;
 	dev->udev = udev;
 	dev->interface = interface;
+	dev->parent = &interface->dev;
+	dev->speed = udev->speed;
 
 	// Read the product release 
 	dev->release = le16_to_cpu(udev->descriptor.bcdDevice);
@@ -876,14 +1520,6 @@ static int usb_stk11xx_probe(struct usb_interface *interface, const struct usb_d
 	STK_INFO("Number of interfaces : %d\n", bNumInterfaces);
 
 
-	// Constructor
-	// 2 : enough for webcam
-	// 3 : for easycap... it's usefull ?
-	dev->nbuffers = 2;
-//	dev->nbuffers = 3;
-	dev->len_per_image = PAGE_ALIGN(STK11XX_FRAME_SIZE);
-
-
 	// Switch on the camera (to detect size of buffers)
 	dev_stk11xx_camera_on(dev);
 
@@ -929,37 +1565,16 @@ static int usb_stk11xx_probe(struct usb_interface *interface, const struct usb_d
 	// Switch off camera
 	dev_stk11xx_camera_off(dev);
 
-	// Initialize the video device
-	dev->vdev = video_device_alloc();
-
-	if (!dev->vdev) {
-		kfree(dev);
-		return -ENOMEM;
-	}
-
-	// Initialize the camera
-	dev_stk11xx_initialize_device(dev);
-	
-	// Register the video device
-	err = v4l_stk11xx_register_video_device(dev);
+	err = usb_stk11xx_register(dev);
 
 	if (err) {
 		kfree(dev);
 		return err;
 	}
 
-	// Create the entries in the sys filesystem
-	stk11xx_create_sysfs_files(dev->vdev);
-
 	// Save our data pointer in this interface device
 	usb_set_intfdata(interface, dev);
 
-	// Default settings video device
-	usb_stk11xx_default_settings(dev);
-	
-	// Enable power management feature
-//	usb_autopm_enable(dev->interface);
-
 	return 0;
 }
 
@@ -976,24 +1591,7 @@ static void usb_stk11xx_disconnect(struct usb_interface *interface)
 
 	STK_INFO("Syntek USB2.0 Camera disconnected\n");
 
-	// We got unplugged; this is signalled by an EPIPE error code
-	if (dev->vopen) {
-		STK_INFO("Disconnected while webcam is in use !\n");
-		dev->error_status = EPIPE;
-	}
-
-	// Alert waiting processes
-	wake_up_interruptible(&dev->wait_frame);
-
-	// Wait until device is closed
-	while (dev->vopen)
-		schedule();
-
-	// Remove the entries in the sys filesystem
-	stk11xx_remove_sysfs_files(dev->vdev);
-
-	// Unregister the video device
-	v4l_stk11xx_unregister_video_device(dev);
+	usb_stk11xx_unregister(dev);
 
 	usb_set_intfdata(interface, NULL);
 	kfree(dev);
@@ -1006,24 +1604,27 @@ int usb_stk11xx_suspend(struct usb_interface *interface, pm_message_t message)
 
 	STK_INFO("Syntek USB2.0 Camera Suspend\n");
 
-	mutex_lock(&dev->modlock);
-	if (dev->vopen) {
-		// Stop the video stream
-		dev_stk11xx_stop_stream(dev);
+	// The device isn't suspended in the middle of its initialization
+	flush_work(&dev->init_work);
 
-		// ISOC and URB cleanup
-		usb_stk11xx_isoc_cleanup(dev);
+	// Nothing may touch the device while it's suspended
+	cancel_delayed_work_sync(&dev->watchdog_work);
+	cancel_delayed_work_sync(&dev->sleep_work);
 
-		// Free memory
-		//	stk11xx_free_buffers(dev);
+	mutex_lock(&dev->modlock);
 
-		// Switch off the camera
-		dev_stk11xx_camera_off(dev);
+	if (dev->streaming)
+		dev_stk11xx_stop_video(dev);
+
+	// The camera isn't left awake, even while a file streams
+	if (dev->warm)
+		dev_stk11xx_sleep(dev);
 
-		dev_stk11xx_camera_asleep(dev);
-	}
 	mutex_unlock(&dev->modlock);
 
+	// Scheduled again by dev_stk11xx_stop_video
+	cancel_delayed_work_sync(&dev->sleep_work);
+
 	return 0;
 }
 
@@ -1036,33 +1637,39 @@ int usb_stk11xx_resume(struct usb_interface *interface)
 
 	mutex_lock(&dev->modlock);
 
-	// Initialize the camera
-	dev_stk11xx_initialize_device(dev);
-
-	if (dev->vopen) {
+	// The device kept its registers and the shadow is still right : it
+	// isn't initialized again (see usb_stk11xx_reset_resume)
+	if (dev->streaming) {
 		// Select the video mode
 		v4l_stk11xx_select_video_mode(dev, dev->view.x, dev->view.y);
 
-		// Clear the buffers
-		stk11xx_clear_buffers(dev);
+		// Restart the camera and the video stream
+		dev_stk11xx_start_video(dev);
+	}
 
-		// Initialize the device
-		dev_stk11xx_init_camera(dev);
-		dev_stk11xx_camera_on(dev);
-		dev_stk11xx_reconf_camera(dev);
+	mutex_unlock(&dev->modlock);
 
-		// ISOC and URB init
-		usb_stk11xx_isoc_init(dev);
+	return 0;
+}
 
-		// Start the video stream
-		dev_stk11xx_start_stream(dev);
 
-		// Video settings
-		dev_stk11xx_camera_settings(dev);
-	}
+int usb_stk11xx_reset_resume(struct usb_interface *interface)
+{
+	struct usb_stk11xx *dev = usb_get_intfdata(interface);
+
+	STK_INFO("Syntek USB2.0 Camera Reset\n");
+
+	mutex_lock(&dev->modlock);
+
+	// The registers are lost
+	usb_stk11xx_invalidate_registry(dev);
+
+	// Initialize the camera
+	usb_stk11xx_initialize(dev);
+
 	mutex_unlock(&dev->modlock);
 
-	return 0;
+	return usb_stk11xx_resume(interface);
 }
 #endif /* CONFIG_PM */
 
@@ -1080,6 +1687,7 @@ static struct usb_driver usb_stk11xx_driver = {
 #ifdef CONFIG_PM
 	.suspend = usb_stk11xx_suspend,
 	.resume = usb_stk11xx_resume,
+	.reset_resume = usb_stk11xx_reset_resume,
 #endif
 };
 
@@ -1132,6 +1740,18 @@ static int colour = -1;
  */
 static int norm = -1;
 
+/**
+ * @var watchdog
+ *   Module parameter to set the time between two checks of the camera
+ */
+static int watchdog = -1;
+
+/**
+ * @var replay
+ *   Module parameter to create virtual cameras
+ */
+static int replay;
+
 
 module_param(fps, int, 0444);			/**< @brief Module frame per second parameter */
 module_param(hflip, int, 0444);			/**< @brief Module horizontal flip process */
@@ -1142,6 +1762,8 @@ module_param(whiteness, int, 0444);		/**< @brief Module whiteness */
 module_param(contrast, int, 0444);		/**< @brief Module contrast */
 module_param(colour, int, 0444);		/**< @brief Module colour */
 module_param(norm, int, 0444);			/**< @brief Module norm */
+module_param(watchdog, int, 0444);		/**< @brief Module watchdog interval */
+module_param(replay, int, 0444);		/**< @brief Module virtual cameras */
 
 
 /** 
@@ -1218,13 +1840,34 @@ static int __init usb_stk11xx_init(void)
 
 		STK_INFO("Set norm = %s\n", (default_norm > 0) ? "NTSC" : "PAL");
 	}
+
+	// Watchdog interval
+	if (watchdog > -1) {
+		STK_DEBUG("Set watchdog interval = %d ms\n", watchdog);
+
+		default_watchdog = watchdog;
+	}
  
 
+	stk11xx_debugfs_init();
+
 	// Register the driver with the USB subsystem
 	result = usb_register(&usb_stk11xx_driver);
 
-	if (result)
+	if (result) {
 		STK_ERROR("usb_register failed ! Error number %d\n", result);
+		stk11xx_debugfs_exit();
+		return result;
+	}
+
+	// The virtual cameras play the recordings of the isoc recorder
+	result = stk11xx_replay_init(replay);
+
+	if (result) {
+		STK_ERROR("Failed to create the virtual cameras ! Error number %d\n", result);
+		usb_deregister(&usb_stk11xx_driver);
+		stk11xx_debugfs_exit();
+	}
 
 	STK_INFO(DRIVER_VERSION " : " DRIVER_DESC "\n");
 
@@ -1241,8 +1884,12 @@ static void __exit usb_stk11xx_exit(void)
 {
 	STK_INFO("usb_stk11xx_exit: Syntek USB2.0 webcam driver shutdown\n");
 
+	stk11xx_replay_exit();
+
 	// Deregister this driver with the USB subsystem
 	usb_deregister(&usb_stk11xx_driver);
+
+	stk11xx_debugfs_exit();
 }
 
 
@@ -1258,6 +1905,8 @@ MODULE_PARM_DESC(whiteness, "Whiteness setting");	/**< @brief Description of 'wh
 MODULE_PARM_DESC(colour, "Colour setting");			/**< @brief Description of 'colour' parameter */
 MODULE_PARM_DESC(contrast, "Contrast setting");		/**< @brief Description of 'contrast' parameter */
 MODULE_PARM_DESC(norm, "Norm setting (0=NTSC, 1=PAL)"); /**< @brief Description of 'default_norm' parameter */
+MODULE_PARM_DESC(watchdog, "Time between two checks of the camera in ms (0=off)"); /**< @brief Description of 'watchdog' parameter */
+MODULE_PARM_DESC(replay, "Number of virtual cameras playing a recording [0-8]"); /**< @brief Description of 'replay' parameter */
 
 
 MODULE_LICENSE("GPL");								/**< @brief Driver is under licence GPL */
@@ -40,14 +40,12 @@
 #include <linux/kref.h>
 #include <linux/vmalloc.h>
 #include <linux/mm.h>
-#if defined(VIDIOCGCAP)
-#include <linux/videodev.h>
-#endif
 
 
 #include <linux/usb.h>
 #include <media/v4l2-common.h>
 #include <media/v4l2-ioctl.h>
+#include <media/videobuf2-v4l2.h>
 
 #include "stk11xx.h"
 
@@ -146,17 +144,17 @@ static struct v4l2_queryctrl stk11xx_controls[] = {
 
 
 /** 
- * @param dev
+ * @param dev Device structure
  * @param width Width of wished resolution
  * @param height Height of wished resolution
  * 
- * @returns 0 if all is OK
+ * @returns Index of the resolution, or -1 if the camera type is unknown
  *
- * @brief Select a video mode
+ * @brief Find the resolution of a video mode
  *
- * This function permits to check and select a video mode.
+ * The width and the height are clamped to the sizes supported by the device.
  */
-int v4l_stk11xx_select_video_mode(struct usb_stk11xx *dev, int width, int height)
+static int v4l_stk11xx_find_resolution(struct usb_stk11xx *dev, int *width, int *height)
 {
 	int i;
 	int find;
@@ -166,36 +164,36 @@ int v4l_stk11xx_select_video_mode(struct usb_stk11xx *dev, int width, int height
 	// Notice : this test is usefull for the Kopete application !
 
 	// Driver can't build an image smaller than the minimal resolution !
-	if ((width < stk11xx_image_sizes[0].x)
-			|| (height < stk11xx_image_sizes[0].y)) {
-		width = stk11xx_image_sizes[0].x;
-		height = stk11xx_image_sizes[0].y;
+	if ((*width < stk11xx_image_sizes[0].x)
+			|| (*height < stk11xx_image_sizes[0].y)) {
+		*width = stk11xx_image_sizes[0].x;
+		*height = stk11xx_image_sizes[0].y;
 	}
 
 	// Driver can't build an image bigger than the maximal resolution !
 	switch (dev->webcam_type) {
 		case STK11XX_SXGA:
-			if ((width > stk11xx_image_sizes[STK11XX_1280x1024].x)
-				|| (height > stk11xx_image_sizes[STK11XX_1280x1024].y)) {
-				width = stk11xx_image_sizes[STK11XX_1280x1024].x;
-				height = stk11xx_image_sizes[STK11XX_1280x1024].y;
+			if ((*width > stk11xx_image_sizes[STK11XX_1280x1024].x)
+				|| (*height > stk11xx_image_sizes[STK11XX_1280x1024].y)) {
+				*width = stk11xx_image_sizes[STK11XX_1280x1024].x;
+				*height = stk11xx_image_sizes[STK11XX_1280x1024].y;
 			}
 			break;
 
 		case STK11XX_VGA:
-			if ((width > stk11xx_image_sizes[STK11XX_640x480].x)
-				|| (height > stk11xx_image_sizes[STK11XX_640x480].y)) {
-				width = stk11xx_image_sizes[STK11XX_640x480].x;
-				height = stk11xx_image_sizes[STK11XX_640x480].y;
+			if ((*width > stk11xx_image_sizes[STK11XX_640x480].x)
+				|| (*height > stk11xx_image_sizes[STK11XX_640x480].y)) {
+				*width = stk11xx_image_sizes[STK11XX_640x480].x;
+				*height = stk11xx_image_sizes[STK11XX_640x480].y;
 			}
 			break;
 
 		case STK11XX_PAL:
-			if (! (((width == 720) && (height==576))
-				|| ((width == 720) && (height==480))
-				|| ((width == 640) && (height==480)))) {
-				width = 640;
-				height = 480;
+			if (! (((*width == 720) && (*height==576))
+				|| ((*width == 720) && (*height==480))
+				|| ((*width == 640) && (*height==480)))) {
+				*width = 640;
+				*height = 480;
 			}
 			break;
 
@@ -208,21 +206,21 @@ int v4l_stk11xx_select_video_mode(struct usb_stk11xx *dev, int width, int height
 	switch (dev->webcam_type) {
 		case STK11XX_SXGA:
 			for (i=0, find=0; i<=STK11XX_1280x1024; i++) {
-				if (stk11xx_image_sizes[i].x <= width && stk11xx_image_sizes[i].y <= height)
+				if (stk11xx_image_sizes[i].x <= *width && stk11xx_image_sizes[i].y <= *height)
 					find = i;
 			}
 			break;
 
 		case STK11XX_VGA:
 			for (i=0, find=0; i<=STK11XX_640x480; i++) {
-				if (stk11xx_image_sizes[i].x <= width && stk11xx_image_sizes[i].y <= height)
+				if (stk11xx_image_sizes[i].x <= *width && stk11xx_image_sizes[i].y <= *height)
 					find = i;
 			}
 			break;
 
 		case STK11XX_PAL:
 			for (i=0, find=0; i<=STK11XX_720x576; i++) {
-				if (stk11xx_image_sizes[i].x <= width && stk11xx_image_sizes[i].y <= height)
+				if (stk11xx_image_sizes[i].x <= *width && stk11xx_image_sizes[i].y <= *height)
 					find = i;
 			}
 			break;
@@ -231,47 +229,86 @@ int v4l_stk11xx_select_video_mode(struct usb_stk11xx *dev, int width, int height
 			return -1;
 	}
 
-	// Save the new resolution
-	dev->resolution = find;
-
-	STK_DEBUG("Set mode %d [%dx%d]\n", dev->resolution,
-			stk11xx_image_sizes[dev->resolution].x, stk11xx_image_sizes[dev->resolution].y);
-
-	// Save the new size
-	dev->view.x = width;
-	dev->view.y = height;
+	return find;
+}
 
 
-	// Calculate the frame size
+/** 
+ * @param dev Device structure
+ * @param resolution Index of the resolution
+ * @param image Size of the frames sent by the sensor
+ *
+ * @brief Get the sensor mode of a resolution
+ *
+ * The sensor only knows a few modes, the smaller resolutions are scaled down
+ * from them by the conversion.
+ */
+static void v4l_stk11xx_sensor_size(struct usb_stk11xx *dev, int resolution,
+		struct stk11xx_coord *image)
+{
 	if (dev->webcam_type == STK11XX_PAL) {
-		// Here, dev->resolution equals : 640x480 || 720x576
-		dev->image.x = stk11xx_image_sizes[dev->resolution].x;
-		dev->image.y = stk11xx_image_sizes[dev->resolution].y;
-		dev->frame_size = dev->image.x * dev->image.y;
+		// Here, resolution equals : 640x480 || 720x576
+		image->x = stk11xx_image_sizes[resolution].x;
+		image->y = stk11xx_image_sizes[resolution].y;
 	}
 	else {
-		switch (dev->resolution) {
+		switch (resolution) {
 			case STK11XX_80x60:
 			case STK11XX_128x96:
 			case STK11XX_160x120:
 			case STK11XX_213x160:
 			case STK11XX_320x240:
 			case STK11XX_640x480:
-				dev->image.x = stk11xx_image_sizes[STK11XX_640x480].x;
-				dev->image.y = stk11xx_image_sizes[STK11XX_640x480].y;
-				dev->frame_size = dev->image.x * dev->image.y;
+				image->x = stk11xx_image_sizes[STK11XX_640x480].x;
+				image->y = stk11xx_image_sizes[STK11XX_640x480].y;
 				break;
 
 			case STK11XX_720x576:
 			case STK11XX_800x600:
 			case STK11XX_1024x768:
 			case STK11XX_1280x1024:
-				dev->image.x = stk11xx_image_sizes[STK11XX_1280x1024].x;
-				dev->image.y = stk11xx_image_sizes[STK11XX_1280x1024].y;
-				dev->frame_size = dev->image.x * dev->image.y;
+				image->x = stk11xx_image_sizes[STK11XX_1280x1024].x;
+				image->y = stk11xx_image_sizes[STK11XX_1280x1024].y;
 				break;
 		}
 	}
+}
+
+
+/** 
+ * @param dev
+ * @param width Width of wished resolution
+ * @param height Height of wished resolution
+ * 
+ * @returns 0 if all is OK
+ *
+ * @brief Select a video mode
+ *
+ * This function permits to check and select a video mode.
+ */
+int v4l_stk11xx_select_video_mode(struct usb_stk11xx *dev, int width, int height)
+{
+	int find;
+
+	find = v4l_stk11xx_find_resolution(dev, &width, &height);
+
+	if (find < 0)
+		return -1;
+
+	// Save the new resolution
+	dev->resolution = find;
+
+	STK_DEBUG("Set mode %d [%dx%d]\n", dev->resolution,
+			stk11xx_image_sizes[dev->resolution].x, stk11xx_image_sizes[dev->resolution].y);
+
+	// Save the new size
+	dev->view.x = width;
+	dev->view.y = height;
+
+
+	// Calculate the frame size
+	v4l_stk11xx_sensor_size(dev, dev->resolution, &dev->image);
+	dev->frame_size = dev->image.x * dev->image.y;
 
 
 	// Calculate the image size
@@ -284,7 +321,7 @@ int v4l_stk11xx_select_video_mode(struct usb_stk11xx *dev, int width, int height
 
 		case STK11XX_PALETTE_RGB32:
 		case STK11XX_PALETTE_BGR32:
-			dev->view_size = 3 * dev->view.x * dev->view.y;
+			dev->view_size = 4 * dev->view.x * dev->view.y;
 			dev->image_size = 4 * dev->frame_size;
 			break;
 
@@ -295,6 +332,69 @@ int v4l_stk11xx_select_video_mode(struct usb_stk11xx *dev, int width, int height
 			break;
 	}
 
+	// The frame rates depend on the sensor mode
+	dev_stk11xx_set_frame_rate(dev, dev->frame_rate);
+
+	return 0;
+}
+
+
+/** 
+ * @param dev Device structure
+ * @param first First resolution supported
+ * @param last Last resolution supported
+ * 
+ * @returns 0 if all is OK
+ *
+ * @brief Get the range of resolutions of the device
+ *
+ * The resolutions are indexes in stk11xx_image_sizes.
+ */
+static int v4l_stk11xx_resolutions(struct usb_stk11xx *dev, int *first, int *last)
+{
+	switch (dev->webcam_type) {
+		case STK11XX_SXGA:
+			*first = STK11XX_80x60;
+			*last = STK11XX_1280x1024;
+			break;
+
+		case STK11XX_VGA:
+			*first = STK11XX_80x60;
+			*last = STK11XX_640x480;
+			break;
+
+		case STK11XX_PAL:
+			*first = STK11XX_640x480;
+			*last = STK11XX_720x576;
+			break;
+
+		default:
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+
+/** 
+ * @param pixelformat V4L2 pixel format
+ * 
+ * @returns 1 if the pixel format is supported
+ *
+ * @brief Check a pixel format
+ */
+static int v4l_stk11xx_valid_format(__u32 pixelformat)
+{
+	switch (pixelformat) {
+		case V4L2_PIX_FMT_RGB24:
+		case V4L2_PIX_FMT_RGB32:
+		case V4L2_PIX_FMT_BGR24:
+		case V4L2_PIX_FMT_BGR32:
+		case V4L2_PIX_FMT_UYVY:
+		case V4L2_PIX_FMT_YUYV:
+			return 1;
+	}
+
 	return 0;
 }
 
@@ -312,6 +412,7 @@ static int v4l_stk11xx_open(struct file *fp)
 {
 	int err;
 
+	struct stk11xx_fh *fh;
 	struct usb_stk11xx *dev;
 	struct video_device *vdev;
 	
@@ -323,68 +424,66 @@ static int v4l_stk11xx_open(struct file *fp)
 		BUG();
 	}
 
+	// The camera is initialized after the probe
+	err = wait_for_completion_interruptible(&dev->init_done);
+
+	if (err)
+		return err;
+
+	// A failed initialization is tried again, unless the camera is gone
 	mutex_lock(&dev->modlock);
 
-	if (dev->vopen) {
-		STK_DEBUG("Device is busy, someone is using the device\n");
-		mutex_unlock(&dev->modlock);
-		return -EBUSY;
-	}
+	if (dev->init_error == -EIO)
+		usb_stk11xx_initialize(dev);
 
-	// Allocate memory
-	err = stk11xx_allocate_buffers(dev);
+	err = dev->init_error;
 
-	if (err < 0) {
-		STK_ERROR("Failed to allocate buffer memory !\n");
-		mutex_unlock(&dev->modlock);
+	mutex_unlock(&dev->modlock);
+
+	if (err)
 		return err;
-	}
-	
-	// Reset buffers and parameters
-	stk11xx_reset_buffers(dev);
-
-	// Settings
-	dev->vsync = 0;
-	dev->v1st_cap = 5;
-	dev->error_status = 0;
-	dev->visoc_errors = 0;
-	dev->vframes_error = 0;
-	dev->vframes_dumped = 0;
-	dev->vsettings.hue = 0xffff;
-	dev->vsettings.whiteness = 0xffff;
-	dev->vsettings.depth = 24;
-	dev->vsettings.palette = STK11XX_PALETTE_BGR24;
-
-	// Select the resolution by default
-	v4l_stk11xx_select_video_mode(dev, 640, 480);
-
-	// Initialize the device
-	dev_stk11xx_init_camera(dev);
-	dev_stk11xx_camera_on(dev);
-	dev_stk11xx_reconf_camera(dev);
-
-	// Init Isoc and URB
-	err = usb_stk11xx_isoc_init(dev);
+
+	fh = kzalloc(sizeof(struct stk11xx_fh), GFP_KERNEL);
+
+	if (fh == NULL)
+		return -ENOMEM;
+
+	fh->dev = dev;
+
+	// Each opened file has its own capture queue
+	err = stk11xx_init_queue(fh);
 
 	if (err) {
-		STK_ERROR("Failed to init ISOC stuff !\n");
-		usb_stk11xx_isoc_cleanup(dev);
-		stk11xx_free_buffers(dev);
-		mutex_unlock(&dev->modlock);
+		kfree(fh);
 		return err;
 	}
 
-	// Start the video stream
-	dev_stk11xx_start_stream(dev);
+	mutex_lock(&dev->modlock);
+
+	// The first file sets the default format, the next ones share it
+	if (dev->vopen == 0) {
+		// Settings
+		dev->vsettings.hue = 0xffff;
+		dev->vsettings.whiteness = 0xffff;
+		dev->vsettings.depth = 24;
+		dev->vsettings.palette = STK11XX_PALETTE_BGR24;
+
+		// Select the resolution by default
+		v4l_stk11xx_select_video_mode(dev, 640, 480);
+	}
 
-	// Video settings
-	dev_stk11xx_camera_settings(dev);
+	// The camera is only started with the capture (see dev_stk11xx_start_video)
 
 	// Register interface on power management
-	usb_autopm_get_interface(dev->interface);
+	if (dev->interface != NULL)
+		usb_autopm_get_interface(dev->interface);
+
+	mutex_lock(&dev->fh_lock);
+	list_add_tail(&fh->list, &dev->fh_list);
+	mutex_unlock(&dev->fh_lock);
 
 	dev->vopen++;
-	fp->private_data = vdev;
+	fp->private_data = fh;
 
 	mutex_unlock(&dev->modlock);
 
@@ -403,34 +502,44 @@ static int v4l_stk11xx_open(struct file *fp)
  */
 static int v4l_stk11xx_release(struct file *fp)
 {
+	struct stk11xx_fh *fh;
 	struct usb_stk11xx *dev;
 	struct video_device *vdev;
 	
 	vdev = video_devdata(fp);
 	dev = video_get_drvdata(video_devdata(fp));
+	fh = fp->private_data;
 
-	if (dev->vopen == 0)
-		STK_ERROR("v4l_release called on closed device\n");
+	// Stop the capture of this file and release its capture buffers
+	mutex_lock(&fh->queue_lock);
+	vb2_queue_release(&fh->vb_queue);
+	mutex_unlock(&fh->queue_lock);
 
-	// Stop the video stream
-	dev_stk11xx_stop_stream(dev);
+	mutex_lock(&dev->modlock);
 
-	// ISOC and URB cleanup
-	usb_stk11xx_isoc_cleanup(dev);
+	if (dev->vopen == 0)
+		STK_ERROR("v4l_release called on closed device\n");
 
-	// Free memory
-	stk11xx_free_buffers(dev);
+	mutex_lock(&dev->fh_lock);
+	list_del(&fh->list);
+	mutex_unlock(&dev->fh_lock);
 
-	// Switch off the camera
-	dev_stk11xx_camera_off(dev);
+	// Another file can now take the format
+	if (dev->owner == fh)
+		dev->owner = NULL;
 
-	dev_stk11xx_camera_asleep(dev);
+	// The buffers stay in the pool for the next capture
 
 	// Unregister interface on power management
-	usb_autopm_put_interface(dev->interface);
+	if (dev->interface != NULL)
+		usb_autopm_put_interface(dev->interface);
 
 	dev->vopen--;
 
+	mutex_unlock(&dev->modlock);
+
+	kfree(fh);
+
 	return 0;
 }
 
@@ -451,18 +560,15 @@ static int v4l_stk11xx_release(struct file *fp)
 static ssize_t v4l_stk11xx_read(struct file *fp, char __user *buf,
 		size_t count, loff_t *f_pos)
 {
-	int noblock = fp->f_flags & O_NONBLOCK;
+	ssize_t ret;
 
+	struct stk11xx_fh *fh;
 	struct usb_stk11xx *dev;
 	struct video_device *vdev;
 
-	int bytes_to_read;
-	void *image_buffer_addr;
-	
-	DECLARE_WAITQUEUE(wait, current);
-
 	vdev = video_devdata(fp);
 	dev = video_get_drvdata(video_devdata(fp));
+	fh = fp->private_data;
 
 	STK_STREAM("Read vdev=0x%p, buf=0x%p, count=%zd\n", vdev, buf, count);
 
@@ -472,70 +578,13 @@ static ssize_t v4l_stk11xx_read(struct file *fp, char __user *buf,
 	if (vdev == NULL)
 		return -EFAULT;
 
-	mutex_lock(&dev->modlock);
-
-	if (dev->image_read_pos == 0) {
-		add_wait_queue(&dev->wait_frame, &wait);
-
-		while (dev->full_frames == NULL) {
-			if (dev->error_status) {
-				remove_wait_queue(&dev->wait_frame, &wait);
-				set_current_state(TASK_RUNNING);
-				mutex_unlock(&dev->modlock);
-				return -dev->error_status ;
-			}
-
-			if (noblock) {
-				remove_wait_queue(&dev->wait_frame, &wait);
-				set_current_state(TASK_RUNNING);
-				mutex_unlock(&dev->modlock);
-				return -EWOULDBLOCK;
-			}
-
-			if (signal_pending(current)) {
-				remove_wait_queue(&dev->wait_frame, &wait);
-				set_current_state(TASK_RUNNING);
-				mutex_unlock(&dev->modlock);
-				return -ERESTARTSYS;
-			}
-
-			schedule();
-			set_current_state(TASK_INTERRUPTIBLE);
-		}
-
-		remove_wait_queue(&dev->wait_frame, &wait);
-		set_current_state(TASK_RUNNING);
+	mutex_lock(&fh->queue_lock);
 
-		if (stk11xx_handle_frame(dev)) {
-			mutex_unlock(&dev->modlock);
-			return -EFAULT;
-		}
-	}
-
-	bytes_to_read = dev->view_size;
+	ret = vb2_read(&fh->vb_queue, buf, count, f_pos, fp->f_flags & O_NONBLOCK);
 
-	if (count + dev->image_read_pos > bytes_to_read)
-		count = bytes_to_read - dev->image_read_pos;
+	mutex_unlock(&fh->queue_lock);
 
-	image_buffer_addr = dev->image_data;
-	image_buffer_addr += dev->images[dev->fill_image].offset;
-	image_buffer_addr += dev->image_read_pos;
-
-	if (copy_to_user(buf, image_buffer_addr, count)) {
-		mutex_unlock(&dev->modlock);
-		return -EFAULT;
-	}
-	
-	dev->image_read_pos += count;
-	
-	if (dev->image_read_pos >= bytes_to_read) {
-		dev->image_read_pos = 0;
-		stk11xx_next_image(dev);
-	}
-
-	mutex_unlock(&dev->modlock);
-
-	return count;
+	return ret;
 }
 
 
@@ -543,35 +592,42 @@ static ssize_t v4l_stk11xx_read(struct file *fp, char __user *buf,
  * @param fp File pointer
  * @param wait 
  * 
- * @returns 0 if all is OK
+ * @returns Poll mask
  *
  * @brief Polling function
+ *
+ * POLLIN is only reported when a buffer can be dequeued without sleeping,
+ * that is when a converted buffer is on the videobuf2 done list. POLLERR is
+ * reported when the device is gone (see vb2_queue_error()) or when nothing
+ * is streaming.
  */
 static unsigned int v4l_stk11xx_poll(struct file *fp, poll_table *wait)
 {
+	unsigned int ret;
+
+	struct stk11xx_fh *fh;
 	struct usb_stk11xx *dev;
 	struct video_device *vdev;
 	
 	vdev = video_devdata(fp);
 	dev = video_get_drvdata(video_devdata(fp));
+	fh = fp->private_data;
 
 	STK_STREAM("Poll\n");
 
 	if (vdev == NULL)
-		return -EFAULT;
+		return POLLERR;
 
 	if (dev == NULL)
-		return -EFAULT;
+		return POLLERR;
 
-	poll_wait(fp, &dev->wait_frame, wait);
+	mutex_lock(&fh->queue_lock);
 
-	if (dev->error_status)
-		return POLLERR;
+	ret = vb2_poll(&fh->vb_queue, fp, wait);
 
-	if (dev->full_frames != NULL)
-		return (POLLIN | POLLRDNORM);
+	mutex_unlock(&fh->queue_lock);
 
-	return 0;
+	return ret;
 }
 
 
@@ -587,74 +643,11 @@ static unsigned int v4l_stk11xx_poll(struct file *fp, poll_table *wait)
  */
 static int v4l_stk11xx_mmap(struct file *fp, struct vm_area_struct *vma)
 {
-	unsigned int i;
-
-	unsigned long size;
-	unsigned long start;
-	unsigned long pos;
-	unsigned long page;
-
-	struct usb_stk11xx *dev;
-
-	struct video_device *vdev;
-	
-	vdev = video_devdata(fp);
-	dev = video_get_drvdata(video_devdata(fp));
+	struct stk11xx_fh *fh = fp->private_data;
 
 	STK_STREAM("mmap\n");
 
-	start = vma->vm_start;
-	size = vma->vm_end - vma->vm_start;
-
-	// Find the buffer for this mapping...
-	for (i=0; i<dev->nbuffers; i++) {
-		pos = dev->images[i].offset;
-
-		if ((pos >> PAGE_SHIFT) == vma->vm_pgoff)
-			break;
-	}
-
-	// If no buffer found !
-	if (i == STK11XX_MAX_IMAGES) {
-		STK_ERROR("mmap no buffer found !\n");
-		return -EINVAL;
-	}
-
-	if (i == 0) {
-		unsigned long total_size;
-
-		total_size = dev->nbuffers * dev->len_per_image;
-
-		if (size != dev->len_per_image && size != total_size) {
-			STK_ERROR("Wrong size (%lu) needed to be len_per_image=%d or total_size=%lu\n",
-				size, dev->len_per_image, total_size);
-				
-			return -EINVAL;
-		}
-	}
-	else if (size > dev->len_per_image)
-		return -EINVAL;
-
-	vma->vm_flags |= VM_IO;
-
-	pos = (unsigned long) dev->image_data;
-
-	while (size > 0) {
-		page = vmalloc_to_pfn((void *) pos);
-
-		if (remap_pfn_range(vma, start, page, PAGE_SIZE, PAGE_SHARED))
-			return -EAGAIN;
-
-		start += PAGE_SIZE;
-		pos += PAGE_SIZE;
-
-		if (size > PAGE_SIZE)
-			size -= PAGE_SIZE;
-		else
-			size = 0;
-	}
-
-	return 0;
+	return vb2_mmap(&fh->vb_queue, vma);
 }
 
 
@@ -672,364 +665,19 @@ static int v4l_stk11xx_mmap(struct file *fp, struct vm_area_struct *vma)
 static long v4l_stk11xx_do_ioctl(struct file *fp,
 		unsigned int cmd, void __user *arg)
 {
+	struct stk11xx_fh *fh;
 	struct usb_stk11xx *dev;
 	struct video_device *vdev;
-
-	DECLARE_WAITQUEUE(wait, current);
 	
 	vdev = video_devdata(fp);
 	dev = video_get_drvdata(video_devdata(fp));
+	fh = fp->private_data;
 
 #if (CONFIG_STK11XX_DEBUG == 1)
 	v4l_printk_ioctl(cmd);
 #endif
 
 	switch (cmd) {
-#ifdef VIDIOCGCAP
-		// Video 4 Linux v1
-
-		case VIDIOCGCAP:
-			{
-				struct video_capability *cap = arg;
-
-				STK_DEBUG("VIDIOCGCAP\n");
-
-				memset(cap, 0, sizeof(*cap));
-				strlcpy(cap->name, "stk11xx", sizeof(cap->name));
-				cap->type = VID_TYPE_CAPTURE;
-				cap->channels = 1;
-				cap->audios = 0;
-
-				switch (dev->webcam_type) {
-					case STK11XX_SXGA:
-						cap->minwidth = stk11xx_image_sizes[STK11XX_80x60].x;
-						cap->minheight = stk11xx_image_sizes[STK11XX_80x60].y;
-						cap->maxwidth = stk11xx_image_sizes[STK11XX_1280x1024].x;
-						cap->maxheight = stk11xx_image_sizes[STK11XX_1280x1024].y;
-						break;
-
-					case STK11XX_PAL:
-						cap->minwidth = stk11xx_image_sizes[STK11XX_640x480].x;
-						cap->minheight = stk11xx_image_sizes[STK11XX_640x480].y;
-						cap->maxwidth = stk11xx_image_sizes[STK11XX_720x576].x;
-						cap->maxheight = stk11xx_image_sizes[STK11XX_720x576].y;
-						break;
-						
-					case STK11XX_VGA:
-						cap->minwidth = stk11xx_image_sizes[STK11XX_80x60].x;
-						cap->minheight = stk11xx_image_sizes[STK11XX_80x60].y;
-						cap->maxwidth = stk11xx_image_sizes[STK11XX_640x480].x;
-						cap->maxheight = stk11xx_image_sizes[STK11XX_640x480].y;
-						break;
-				}
-			}
-			break;
-	
-		case VIDIOCGCHAN:
-			{
-			    struct video_channel *v = arg;
-
-				STK_DEBUG("VIDIOCGCHAN\n");
-
-			    if (v->channel != 0)
-				    return -EINVAL;
-			
-				v->flags = 0;
-			    v->tuners = 0;
-			    v->type = VIDEO_TYPE_CAMERA;
-			    strcpy(v->name, "Webcam");
-			}
-			break;
-
-		case VIDIOCSCHAN:
-			{
-				struct video_channel *v = arg;
-
-				STK_DEBUG("VIDIOCSCHAN\n");
-
-				if (v->channel != 0)
-					return -EINVAL;
-			}
-			break;
-
-		case VIDIOCGPICT:
-			{
-				struct video_picture *p = arg;
-
-				STK_DEBUG("VIDIOCGPICT\n");
-
-				p->brightness = dev->vsettings.brightness;
-				p->contrast = dev->vsettings.contrast;
-				p->whiteness = dev->vsettings.whiteness;
-				p->colour = dev->vsettings.colour;
-				p->depth = dev->vsettings.depth;
-				p->palette = dev->vsettings.palette;
-				p->hue = dev->vsettings.hue;
-
-				switch (dev->vsettings.palette) {
-					case STK11XX_PALETTE_BGR24:
-						p->palette = VIDEO_PALETTE_RGB24;
-						break;
-
-					case STK11XX_PALETTE_BGR32:
-						p->palette = VIDEO_PALETTE_RGB32;
-						break;
-
-					case STK11XX_PALETTE_UYVY:
-						p->palette = VIDEO_PALETTE_UYVY;
-						break;
-
-					case STK11XX_PALETTE_YUYV:
-						p->palette = VIDEO_PALETTE_YUYV;
-						break;
-				}
-			}
-			break;
-
-		case VIDIOCSPICT:
-			{
-				struct video_picture *p = arg;
-
-				STK_DEBUG("VIDIOCSPICT\n");
-
-				dev->vsettings.brightness = p->brightness;
-				dev->vsettings.contrast = p->contrast;
-				dev->vsettings.whiteness = p->whiteness;
-				dev->vsettings.colour = p->colour;
-				dev->vsettings.hue = p->hue;
-				
-				if (p->palette && p->palette != dev->vsettings.palette) {
-					switch (p->palette) {
-						case VIDEO_PALETTE_RGB24:
-							dev->vsettings.depth = 24;
-							dev->vsettings.palette = STK11XX_PALETTE_BGR24;
-							break;
-
-						case VIDEO_PALETTE_RGB32:
-							dev->vsettings.depth = 32;
-							dev->vsettings.palette = STK11XX_PALETTE_BGR32;
-							break;
-
-						case VIDEO_PALETTE_UYVY:
-							dev->vsettings.depth = 16;
-							dev->vsettings.palette = STK11XX_PALETTE_UYVY;
-							break;
-
-						case VIDEO_PALETTE_YUYV:
-							dev->vsettings.depth = 16;
-							dev->vsettings.palette = STK11XX_PALETTE_YUYV;
-							break;
-
-						default:
-							return -EINVAL;
-					}
-				}
-
-				dev_stk11xx_camera_settings(dev);
-
-				STK_DEBUG("VIDIOCSPICT done\n");
-			}
-			break;
-
-		case VIDIOCGWIN:
-			{
-				struct video_window *vw = arg;
-
-				STK_DEBUG("VIDIOCGWIN\n");
-
-				vw->x = 0;
-				vw->y = 0;
-				vw->width = dev->view.x;
-				vw->height = dev->view.y;
-				vw->chromakey = 0;
-			}
-			break;
-
-		case VIDIOCSWIN:
-			{
-				struct video_window *vw = arg;
-
-				STK_DEBUG("VIDIOCSWIN\n");
-
-				STK_DEBUG("Set x=%d, y=%d\n", vw->x, vw->y);
-				STK_DEBUG("Set width=%d, height=%d\n", vw->width, vw->height);
-				STK_DEBUG("Flags = %X\n", vw->flags);
-
-				// Stop the video stream
-				dev_stk11xx_stop_stream(dev);
-			
-				// ISOC and URB cleanup
-				usb_stk11xx_isoc_cleanup(dev);
-
-				// Switch off the camera
-				dev_stk11xx_camera_off(dev);
-
-				dev_stk11xx_camera_asleep(dev);
-
-				// Select the new video mode
-				if (v4l_stk11xx_select_video_mode(dev, vw->width, vw->height)) {
-					STK_ERROR("Select video mode failed !\n");
-					return -EAGAIN;
-				}
-
-				// Clear the buffers
-				stk11xx_clear_buffers(dev);
-
-				// Initialize the device
-				dev_stk11xx_init_camera(dev);
-				dev_stk11xx_camera_on(dev);
-				dev_stk11xx_reconf_camera(dev);
-
-				// ISOC and URB init
-				usb_stk11xx_isoc_init(dev);
-
-				// Re-start the stream
-				dev_stk11xx_start_stream(dev);
-
-				// Video settings
-				dev_stk11xx_camera_settings(dev);
-			}
-			break;
-
-		case VIDIOCGFBUF:
-			{
-				struct video_buffer *vb = arg;
-
-				STK_DEBUG("VIDIOCGFBUF\n");
-
-				memset(vb, 0, sizeof(*vb));
-			}
-			break;
-
-		case VIDIOCGMBUF:
-			{
-				int i;
-				struct video_mbuf *vm = arg;
-
-				STK_DEBUG("VIDIOCGMBUF\n");
-
-				memset(vm, 0, sizeof(*vm));
-
-				vm->size = dev->nbuffers * dev->len_per_image;
-				vm->frames = dev->nbuffers;
-
-				for (i=0; i<dev->nbuffers; i++)
-					vm->offsets[i] = i * dev->len_per_image;
-			}
-			break;
-
-		case VIDIOCMCAPTURE:
-			{
-				struct video_mmap *vm = arg;
-
-				STK_DEBUG("VIDIOCMCAPTURE format=%d\n", vm->format);
-
-				if (vm->frame < 0 || vm->frame >= dev->nbuffers)
-					return -EINVAL;
-
-				if (vm->format) {
-					switch (vm->format) {
-						case VIDEO_PALETTE_RGB32:
-							break;
-
-						case VIDEO_PALETTE_RGB24:
-							break;
-
-						case VIDEO_PALETTE_UYVY:
-							break;
-
-						case VIDEO_PALETTE_YUYV:
-							break;
-
-						default:
-							return -EINVAL;
-					}
-				}
-
-				if ((vm->width != dev->view.x) || (vm->height != dev->view.y)) 
-					return -EAGAIN;
-
-				if (dev->image_used[vm->frame])
-					return -EBUSY;
-
-				dev->image_used[vm->frame] = 1;
-
-				STK_DEBUG("VIDIOCMCAPTURE done\n");
-			}
-			break;
-
-		case VIDIOCSYNC:
-			{
-				int ret;
-				int *mbuf = arg;
-
-				STK_DEBUG("VIDIOCSYNC\n");
-
-				if (*mbuf < 0 || *mbuf >= dev->nbuffers)
-					return -EINVAL;
-
-				if (dev->image_used[*mbuf] == 0)
-					return -EINVAL;
-
-				add_wait_queue(&dev->wait_frame, &wait);
-
-				while (dev->full_frames == NULL) {
-					if (dev->error_status) {
-						remove_wait_queue(&dev->wait_frame, &wait);
-						set_current_state(TASK_RUNNING);
-						return -dev->error_status;
-					}
-
-					if (signal_pending(current)) {
-						remove_wait_queue(&dev->wait_frame, &wait);
-						set_current_state(TASK_RUNNING);
-						return -ERESTARTSYS;
-					}
-
-					schedule();
-					set_current_state(TASK_INTERRUPTIBLE);
-				}
-
-				remove_wait_queue(&dev->wait_frame, &wait);
-				set_current_state(TASK_RUNNING);
-
-				STK_DEBUG("VIDIOCSYNC: frame ready\n");
-
-				dev->fill_image = *mbuf;
-
-				ret = stk11xx_handle_frame(dev);
-
-				if (ret != 0)
-					STK_ERROR("VIDIOCSYNC error !\n");
-
-				dev->image_used[*mbuf] = 0;
-			}
-			break;
-
-		case VIDIOCGAUDIO:
-			STK_DEBUG("VIDIOCGAUDIO\n");
-			return -EINVAL;
-			break;
-
-		case VIDIOCSAUDIO:
-			STK_DEBUG("VIDIOCSAUDIO\n");
-			return -EINVAL;
-			break;
-
-		case VIDIOCGUNIT:
-			{
-				struct video_unit *vu = arg;
-
-				vu->video = dev->vdev->minor & 0x3f;
-				vu->audio = -1;
-				vu->vbi = -1;
-				vu->radio = -1;
-				vu->teletext = -1;
-			}
-			break;
-#endif /* VIDIOCGCAP */
-
-
 		// Video 4 Linux v2
 
 		case VIDIOC_QUERYCAP:
@@ -1039,13 +687,15 @@ static long v4l_stk11xx_do_ioctl(struct file *fp,
 				STK_DEBUG("VIDIOC_QUERYCAP\n");
 
 				memset(cap, 0, sizeof(*cap));
-				strlcpy(cap->driver, "stk11xx", sizeof(cap->driver));
+				strscpy(cap->driver, "stk11xx", sizeof(cap->driver));
 
 				cap->capabilities = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_READWRITE | V4L2_CAP_STREAMING;
-				cap->version = (__u32) DRIVER_VERSION_NUM, strlcpy(cap->card, dev->vdev->name, sizeof(cap->card));
+				cap->version = (__u32) DRIVER_VERSION_NUM, strscpy(cap->card, dev->vdev->name, sizeof(cap->card));
 			
-				if (usb_make_path(dev->udev, cap->bus_info, sizeof(cap->bus_info)) < 0)
-					strlcpy(cap->bus_info, dev->vdev->name, sizeof(cap->bus_info));
+				if (dev->udev == NULL)
+					snprintf(cap->bus_info, sizeof(cap->bus_info), "platform:%s", dev_name(dev->parent));
+				else if (usb_make_path(dev->udev, cap->bus_info, sizeof(cap->bus_info)) < 0)
+					strscpy(cap->bus_info, dev->vdev->name, sizeof(cap->bus_info));
 			}
 			break;
 
@@ -1058,7 +708,7 @@ static long v4l_stk11xx_do_ioctl(struct file *fp,
 				if (dev->webcam_model != SYNTEK_STK_0408) {
 					if (i->index)
 						return -EINVAL;
-					strlcpy(i->name, "USB", sizeof(i->name));
+					strscpy(i->name, "USB", sizeof(i->name));
 				}
 				else {
 					if (i->index > 3)
@@ -1066,16 +716,16 @@ static long v4l_stk11xx_do_ioctl(struct file *fp,
 					
 					switch (i->index) {
 						case 0:
-							strlcpy(i->name, "Input1", sizeof(i->name));
+							strscpy(i->name, "Input1", sizeof(i->name));
 							break;
 						case 1:
-							strlcpy(i->name, "Input2", sizeof(i->name));
+							strscpy(i->name, "Input2", sizeof(i->name));
 							break;
 						case 2:
-							strlcpy(i->name, "Input3", sizeof(i->name));
+							strscpy(i->name, "Input3", sizeof(i->name));
 							break;
 						case 3:
-							strlcpy(i->name, "Input4", sizeof(i->name));
+							strscpy(i->name, "Input4", sizeof(i->name));
 							break;
 					}
 				}
@@ -1105,7 +755,9 @@ static long v4l_stk11xx_do_ioctl(struct file *fp,
 				
 				dev->vsettings.input = i->index + 1;
 
-				dev_stk11xx_camera_settings(dev);
+				// Otherwise the settings are written when the stream starts
+				if (dev->streaming)
+					dev_stk11xx_camera_settings(dev);
 			}
 			break;
 
@@ -1229,7 +881,8 @@ static long v4l_stk11xx_do_ioctl(struct file *fp,
 						return -EINVAL;
 				}
 
-				dev_stk11xx_camera_settings(dev);
+				if (dev->streaming)
+					dev_stk11xx_camera_settings(dev);
 			}
 			break;
 
@@ -1439,6 +1092,14 @@ static long v4l_stk11xx_do_ioctl(struct file *fp,
 
 		case VIDIOC_S_FMT:
 			{
+				int err;
+				int busy;
+				int depth;
+				int width;
+				int height;
+				int palette;
+				int resolution;
+				struct stk11xx_coord image;
 				struct v4l2_format *fmtd = arg;
 
 				STK_DEBUG("SET FMT %d : %d\n", fmtd->type, fmtd->fmt.pix.pixelformat);
@@ -1446,49 +1107,57 @@ static long v4l_stk11xx_do_ioctl(struct file *fp,
 				if (fmtd->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
 					return -EINVAL;
 
+				// Only one file sets the format, the others use it
+				if (dev->owner && (dev->owner != fh))
+					return -EBUSY;
+
+				// The capture buffers are sized for the current format, the
+				// buffers of the other files are only known by their count
+				busy = dev->streaming || dev->buffers_allocated || vb2_is_busy(&fh->vb_queue);
+
 				fmtd->fmt.pix.field = V4L2_FIELD_NONE;
 				fmtd->fmt.pix.colorspace = V4L2_COLORSPACE_SRGB;
 				fmtd->fmt.pix.priv = 0;
 
 				switch (fmtd->fmt.pix.pixelformat) {
 					case V4L2_PIX_FMT_RGB24:
-						dev->vsettings.depth = 24;
-						dev->vsettings.palette = STK11XX_PALETTE_RGB24;
+						depth = 24;
+						palette = STK11XX_PALETTE_RGB24;
 						fmtd->fmt.pix.sizeimage = fmtd->fmt.pix.width * fmtd->fmt.pix.height * 3;
 						fmtd->fmt.pix.bytesperline = 3 * fmtd->fmt.pix.width;
 						break;
 
 					case V4L2_PIX_FMT_RGB32:
-						dev->vsettings.depth = 32;
-						dev->vsettings.palette = STK11XX_PALETTE_RGB32;
+						depth = 32;
+						palette = STK11XX_PALETTE_RGB32;
 						fmtd->fmt.pix.sizeimage = fmtd->fmt.pix.width * fmtd->fmt.pix.height * 4;
 						fmtd->fmt.pix.bytesperline = 4 * fmtd->fmt.pix.width;
 						break;
 
 					case V4L2_PIX_FMT_BGR24:
-						dev->vsettings.depth = 24;
-						dev->vsettings.palette = STK11XX_PALETTE_BGR24;
+						depth = 24;
+						palette = STK11XX_PALETTE_BGR24;
 						fmtd->fmt.pix.sizeimage = fmtd->fmt.pix.width * fmtd->fmt.pix.height * 3;
 						fmtd->fmt.pix.bytesperline = 3 * fmtd->fmt.pix.width;
 						break;
 
 					case V4L2_PIX_FMT_BGR32:
-						dev->vsettings.depth = 32;
-						dev->vsettings.palette = STK11XX_PALETTE_BGR32;
+						depth = 32;
+						palette = STK11XX_PALETTE_BGR32;
 						fmtd->fmt.pix.sizeimage = fmtd->fmt.pix.width * fmtd->fmt.pix.height * 4;
 						fmtd->fmt.pix.bytesperline = 4 * fmtd->fmt.pix.width;
 						break;
 
 					case V4L2_PIX_FMT_UYVY:
-						dev->vsettings.depth = 16;
-						dev->vsettings.palette = STK11XX_PALETTE_UYVY;
+						depth = 16;
+						palette = STK11XX_PALETTE_UYVY;
 						fmtd->fmt.pix.sizeimage = fmtd->fmt.pix.width * fmtd->fmt.pix.height * 2;
 						fmtd->fmt.pix.bytesperline = 2 * fmtd->fmt.pix.width;
 						break;
 
 					case V4L2_PIX_FMT_YUYV:
-						dev->vsettings.depth = 16;
-						dev->vsettings.palette = STK11XX_PALETTE_YUYV;
+						depth = 16;
+						palette = STK11XX_PALETTE_YUYV;
 						fmtd->fmt.pix.sizeimage = fmtd->fmt.pix.width * fmtd->fmt.pix.height * 2;
 						fmtd->fmt.pix.bytesperline = 2 * fmtd->fmt.pix.width;
 						break;
@@ -1499,39 +1168,41 @@ static long v4l_stk11xx_do_ioctl(struct file *fp,
 
 				STK_DEBUG("Set width=%d, height=%d\n", fmtd->fmt.pix.width, fmtd->fmt.pix.height);
 
-				// Stop the video stream
-				dev_stk11xx_stop_stream(dev);
-			
-				// ISOC and URB cleanup
-				usb_stk11xx_isoc_cleanup(dev);
+				width = fmtd->fmt.pix.width;
+				height = fmtd->fmt.pix.height;
+				resolution = v4l_stk11xx_find_resolution(dev, &width, &height);
 
-				// Switch off the camera
-				dev_stk11xx_camera_off(dev);
+				if (resolution < 0)
+					return -EINVAL;
 
-				dev_stk11xx_camera_asleep(dev);
+				// While capturing, only the conversion may change : the sensor
+				// mode stays and the image still fits in the capture buffers
+				if (busy) {
+					v4l_stk11xx_sensor_size(dev, resolution, &image);
 
-				// Select the new video mode
-				if (v4l_stk11xx_select_video_mode(dev, fmtd->fmt.pix.width, fmtd->fmt.pix.height)) {
-					STK_ERROR("Select video mode failed !\n");
-					return -EAGAIN;
+					if ((image.x != dev->image.x) || (image.y != dev->image.y))
+						return -EBUSY;
+
+					if ((depth / 8) * width * height > dev->view_size)
+						return -EBUSY;
 				}
 
-				// Clear the buffers
-				stk11xx_clear_buffers(dev);
+				// The frame work converts the next frame in the new format
+				mutex_lock(&dev->fh_lock);
 
-				// Initialize the device
-				dev_stk11xx_init_camera(dev);
-				dev_stk11xx_camera_on(dev);
-				dev_stk11xx_reconf_camera(dev);
+				dev->vsettings.depth = depth;
+				dev->vsettings.palette = palette;
 
-				// ISOC and URB init
-				usb_stk11xx_isoc_init(dev);
+				err = v4l_stk11xx_select_video_mode(dev, width, height);
 
-				// Re-start the stream
-				dev_stk11xx_start_stream(dev);
+				mutex_unlock(&dev->fh_lock);
 
-				// Video settings
-				dev_stk11xx_camera_settings(dev);
+				if (err) {
+					STK_ERROR("Select video mode failed !\n");
+					return -EAGAIN;
+				}
+
+				dev->owner = fh;
 			}
 			break;
 
@@ -1580,53 +1251,21 @@ static long v4l_stk11xx_do_ioctl(struct file *fp,
 
 		case VIDIOC_REQBUFS:
 			{
-				int nbuffers;
 				struct v4l2_requestbuffers *rb = arg;
 
-				if (rb->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
-					return -EINVAL;
-
-				if (rb->memory != V4L2_MEMORY_MMAP)
-					return -EINVAL;
-
-				nbuffers = rb->count;
-
-				if (nbuffers < 2)
-					nbuffers = 2;
-				else if (nbuffers > dev->nbuffers)
-					nbuffers = dev->nbuffers;
+				STK_DEBUG("VIDIOC_REQBUFS %d\n", rb->count);
 
-				rb->count = dev->nbuffers;
+				return vb2_reqbufs(&fh->vb_queue, rb);
 			}
 			break;
 
 		case VIDIOC_QUERYBUF:
 			{
-				int index;
 				struct v4l2_buffer *buf = arg;
 
-				STK_DEBUG("QUERY BUFFERS %d %d\n", buf->index, dev->nbuffers);
-
-				if (buf->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
-					return -EINVAL;
+				STK_DEBUG("QUERY BUFFERS %d\n", buf->index);
 
-				if (buf->memory != V4L2_MEMORY_MMAP) 
-					return -EINVAL;
-
-				index = buf->index;
-
-				if (index < 0 || index >= dev->nbuffers)
-					return -EINVAL;
-
-				memset(buf, 0, sizeof(struct v4l2_buffer));
-
-				buf->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-				buf->index = index;
-				buf->m.offset = index * dev->len_per_image;
-				buf->bytesused = dev->view_size;
-				buf->field = V4L2_FIELD_NONE;
-				buf->memory = V4L2_MEMORY_MMAP;
-				buf->length = dev->len_per_image;
+				return vb2_querybuf(&fh->vb_queue, buf);
 			}
 			break;
 
@@ -1636,88 +1275,51 @@ static long v4l_stk11xx_do_ioctl(struct file *fp,
 
 				STK_DEBUG("VIDIOC_QBUF\n");
 
-				if (buf->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
-					return -EINVAL;
+				return vb2_qbuf(&fh->vb_queue, buf);
+			}
+			break;
 
-				if (buf->memory != V4L2_MEMORY_MMAP)
-					return -EINVAL;
+		case VIDIOC_EXPBUF:
+			{
+				struct v4l2_exportbuffer *eb = arg;
 
-				if (buf->index < 0 || buf->index >= dev->nbuffers)
-					return -EINVAL;
+				STK_DEBUG("VIDIOC_EXPBUF %d\n", eb->index);
 
-				buf->flags |= V4L2_BUF_FLAG_QUEUED;
-				buf->flags &= ~V4L2_BUF_FLAG_DONE;
+				return vb2_expbuf(&fh->vb_queue, eb);
 			}
 			break;
 
 		case VIDIOC_DQBUF:
 			{
-				int ret;
 				struct v4l2_buffer *buf = arg;
 
 				STK_DEBUG("VIDIOC_DQBUF\n");
-				
-				if (buf->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
-					return -EINVAL;
-
-				add_wait_queue(&dev->wait_frame, &wait);
-
-				while (dev->full_frames == NULL) {
-					if (dev->error_status) {
-						remove_wait_queue(&dev->wait_frame, &wait);
-						set_current_state(TASK_RUNNING);
-
-						return -dev->error_status;
-					}
-
-					if (signal_pending(current)) {
-						remove_wait_queue(&dev->wait_frame, &wait);
-						set_current_state(TASK_RUNNING);
-
-						return -ERESTARTSYS;
-					}
-
-					schedule();
-					set_current_state(TASK_INTERRUPTIBLE);
-				}
 
-				remove_wait_queue(&dev->wait_frame, &wait);
-				set_current_state(TASK_RUNNING);
-
-				STK_DEBUG("VIDIOC_DQBUF : frame ready.\n");
-
-				ret = stk11xx_handle_frame(dev);
-
-				if (ret)
-					return -EFAULT;
-
-				buf->index = dev->fill_image;
-				buf->bytesused = dev->view_size;
-				buf->flags = V4L2_BUF_FLAG_MAPPED;
-				buf->field = V4L2_FIELD_NONE;
-				do_gettimeofday(&buf->timestamp);
-				buf->sequence = 0;
-				buf->memory = V4L2_MEMORY_MMAP;
-				buf->m.offset = dev->fill_image * dev->len_per_image;
-				buf->length = dev->len_per_image; //buf->bytesused;
-
-				stk11xx_next_image(dev);
+				// Returns -EAGAIN with O_NONBLOCK when no buffer is done,
+				// otherwise queue_lock is released while waiting for a buffer
+				return vb2_dqbuf(&fh->vb_queue, buf, fp->f_flags & O_NONBLOCK);
 			}
 			break;
 
 		case VIDIOC_STREAMON:
 			{
+				enum v4l2_buf_type *type = arg;
+
 				STK_DEBUG("VIDIOC_STREAMON\n");
 
-				usb_stk11xx_isoc_init(dev);
+				// The camera is started by the queue once it streams
+				return vb2_streamon(&fh->vb_queue, *type);
 			}
 			break;
 
 		case VIDIOC_STREAMOFF:
 			{
+				enum v4l2_buf_type *type = arg;
+
 				STK_DEBUG("VIDIOC_STREAMOFF\n");
 
-				usb_stk11xx_isoc_cleanup(dev);
+				// The camera is switched off and the queued buffers are given back
+				return vb2_streamoff(&fh->vb_queue, *type);
 			}
 			break;
 
@@ -1730,15 +1332,112 @@ static long v4l_stk11xx_do_ioctl(struct file *fp,
 				if (sp->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
 					return -EINVAL;
 
-				sp->parm.capture.capability = 0;
+				memset(&sp->parm, 0, sizeof(sp->parm));
+
+				sp->parm.capture.capability = V4L2_CAP_TIMEPERFRAME;
 				sp->parm.capture.capturemode = 0;
 				sp->parm.capture.timeperframe.numerator = 1;
-				sp->parm.capture.timeperframe.denominator = 30;
+				sp->parm.capture.timeperframe.denominator = dev->frame_rate;
 				sp->parm.capture.readbuffers = 2;
 				sp->parm.capture.extendedmode = 0;
 			}
 			break;
 
+		case VIDIOC_S_PARM:
+			{
+				int fps;
+				struct v4l2_streamparm *sp = arg;
+				struct v4l2_fract *tpf = &sp->parm.capture.timeperframe;
+
+				STK_DEBUG("SET PARM %d : %d/%d\n", sp->type, tpf->numerator, tpf->denominator);
+
+				if (sp->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+					return -EINVAL;
+
+				// The frame rate is shared by all the files, like the format
+				if (dev->owner && (dev->owner != fh))
+					return -EBUSY;
+
+				// A null interval keeps the current frame rate
+				if (tpf->numerator == 0 || tpf->denominator == 0)
+					fps = dev->frame_rate;
+				else
+					fps = tpf->denominator / tpf->numerator;
+
+				// Take the nearest frame rate supported in this resolution
+				dev_stk11xx_set_frame_rate(dev, fps);
+
+				dev->owner = fh;
+
+				memset(&sp->parm, 0, sizeof(sp->parm));
+
+				sp->parm.capture.capability = V4L2_CAP_TIMEPERFRAME;
+				sp->parm.capture.timeperframe.numerator = 1;
+				sp->parm.capture.timeperframe.denominator = dev->frame_rate;
+				sp->parm.capture.readbuffers = 2;
+			}
+			break;
+
+		case VIDIOC_ENUM_FRAMESIZES:
+			{
+				int first;
+				int last;
+				struct v4l2_frmsizeenum *fsize = arg;
+
+				STK_DEBUG("VIDIOC_ENUM_FRAMESIZES %d\n", fsize->index);
+
+				if (!v4l_stk11xx_valid_format(fsize->pixel_format))
+					return -EINVAL;
+
+				if (v4l_stk11xx_resolutions(dev, &first, &last))
+					return -EINVAL;
+
+				if (fsize->index > last - first)
+					return -EINVAL;
+
+				fsize->type = V4L2_FRMSIZE_TYPE_DISCRETE;
+				fsize->discrete.width = stk11xx_image_sizes[first + fsize->index].x;
+				fsize->discrete.height = stk11xx_image_sizes[first + fsize->index].y;
+			}
+			break;
+
+		case VIDIOC_ENUM_FRAMEINTERVALS:
+			{
+				int i;
+				int first;
+				int last;
+				int nrates;
+				const int *rates;
+				struct v4l2_frmivalenum *fival = arg;
+
+				STK_DEBUG("VIDIOC_ENUM_FRAMEINTERVALS %d\n", fival->index);
+
+				if (!v4l_stk11xx_valid_format(fival->pixel_format))
+					return -EINVAL;
+
+				if (v4l_stk11xx_resolutions(dev, &first, &last))
+					return -EINVAL;
+
+				for (i=first; i<=last; i++) {
+					if (stk11xx_image_sizes[i].x == fival->width
+							&& stk11xx_image_sizes[i].y == fival->height)
+						break;
+				}
+
+				if (i > last)
+					return -EINVAL;
+
+				nrates = dev_stk11xx_frame_rates(dev, i, &rates);
+
+				if (fival->index >= nrates)
+					return -EINVAL;
+
+				fival->type = V4L2_FRMIVAL_TYPE_DISCRETE;
+				fival->discrete.numerator = 1;
+				fival->discrete.denominator = rates[fival->index];
+			}
+			break;
+
 
 		case VIDIOC_G_AUDIO:
 			STK_DEBUG("GET AUDIO\n");
@@ -1815,11 +1514,13 @@ static long v4l_stk11xx_ioctl(struct file *fp,
 		unsigned int cmd, unsigned long arg)
 {
 	long err;
+	struct stk11xx_fh *fh;
 	struct usb_stk11xx *dev;
 	struct video_device *vdev;
 	
 	vdev = video_devdata(fp);
 	dev = video_get_drvdata(video_devdata(fp));
+	fh = fp->private_data;
 
 	STK_DEBUG("v4l_stk11xx_ioctl %02X\n", (unsigned char) cmd);
 
@@ -1829,11 +1530,36 @@ static long v4l_stk11xx_ioctl(struct file *fp,
 	if (vdev == NULL)
 		return -EFAULT;
 
-	mutex_lock(&dev->modlock); 
+	switch (cmd) {
+		// The buffer ioctls only use the capture queue, DQBUF may sleep
+		case VIDIOC_REQBUFS:
+		case VIDIOC_QUERYBUF:
+		case VIDIOC_QBUF:
+		case VIDIOC_EXPBUF:
+		case VIDIOC_DQBUF:
+		// The queue takes modlock itself when it starts or stops the camera
+		case VIDIOC_STREAMON:
+		case VIDIOC_STREAMOFF:
+			mutex_lock(&fh->queue_lock);
+			err = video_usercopy(fp, cmd, arg, v4l_stk11xx_do_ioctl);
+			mutex_unlock(&fh->queue_lock);
+			break;
 
-	err = video_usercopy(fp, cmd, arg, v4l_stk11xx_do_ioctl);
+		// S_FMT changes both the device and the capture queue
+		case VIDIOC_S_FMT:
+			mutex_lock(&fh->queue_lock);
+			mutex_lock(&dev->modlock);
+			err = video_usercopy(fp, cmd, arg, v4l_stk11xx_do_ioctl);
+			mutex_unlock(&dev->modlock);
+			mutex_unlock(&fh->queue_lock);
+			break;
 
-	mutex_unlock(&dev->modlock);
+		default:
+			mutex_lock(&dev->modlock);
+			err = video_usercopy(fp, cmd, arg, v4l_stk11xx_do_ioctl);
+			mutex_unlock(&dev->modlock);
+			break;
+	}
 
 	return err;
 }
@@ -1852,10 +1578,9 @@ int v4l_stk11xx_register_video_device(struct usb_stk11xx *dev)
 {
 	int err;
 
-	err = v4l2_device_register(&dev->interface->dev, &dev->v4l2_dev);
+	err = v4l2_device_register(dev->parent, &dev->v4l2_dev);
 	if (err < 0) {
 		STK_ERROR("couldn't register v4l2_device\n");
-		kfree(dev);
 		return err;
 	}
 
@@ -1867,9 +1592,16 @@ int v4l_stk11xx_register_video_device(struct usb_stk11xx *dev)
 	dev->vdev->release = video_device_release;
 	dev->vdev->minor = -1;
 
+	// Checked by video_register_device since Linux 5.3
+	dev->vdev->device_caps = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_READWRITE | V4L2_CAP_STREAMING;
+
 	video_set_drvdata(dev->vdev, dev);
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,7,0)
+	err = video_register_device(dev->vdev, VFL_TYPE_VIDEO, -1);
+#else
 	err = video_register_device(dev->vdev, VFL_TYPE_GRABBER, -1);
+#endif
 
 	if (err)
 		STK_ERROR("Video register fail !\n");
@@ -33,7 +33,14 @@
 
 #ifndef STK11XX_H
 #define STK11XX_H
+#include <linux/version.h>
+#include <linux/shrinker.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/kfifo.h>
 #include <media/v4l2-device.h>
+#include <media/videobuf2-v4l2.h>
 
 
 #define DRIVER_NAME					"stk11xx"					/**< Name of this driver */
@@ -91,18 +98,122 @@
 
 
 /**
+ * @def STK11XX_MIN_IMAGES
+ *   Minimum number of capture buffers requested from the application
+ *
  * @def STK11XX_MAX_IMAGES
- *   Absolute maximum number of buffers available for mmap()
+ *   Absolute maximum number of capture buffers
  *
- * @def STK11XX_FRAME_SIZE
- *   Maximum size after decompression. Warning, we use a big buffer to be able to work
- *   with a image resolution 1280x1024 ! If your device doesn't support these resolutions
- *   or that you work in an embedded device, you should use a smaller buffer.
- *   TODO :
- *   Allocate a buffer with a dynamical size adapted for the current resolution...
+ * The frame buffers are sized for the current sensor mode (dev->frame_size). They
+ * only grow when a new format needs more memory. The capture buffers are owned by
+ * the videobuf2 queue and sized for the current view (dev->view_size).
  */
+#define STK11XX_MIN_IMAGES			2
 #define STK11XX_MAX_IMAGES			10
-#define STK11XX_FRAME_SIZE			(1280 * 1024 * 4)
+
+
+/**
+ * @def STK11XX_FRAME_RING_SIZE
+ *   Number of slots in a frame ring. Must be a power of two and strictly greater than
+ *   the number of frame buffers, so that a ring can never overflow.
+ */
+#define STK11XX_FRAME_RING_SIZE		8
+
+
+/**
+ * @def STK11XX_WATCHDOG_INTERVAL
+ *   Default time between two checks of the camera (ms), 0 disables the watchdog
+ *
+ * @def STK11XX_WATCHDOG_FAILURES
+ *   Number of failed checks in a row before the stream is restarted
+ */
+#define STK11XX_WATCHDOG_INTERVAL	1000
+#define STK11XX_WATCHDOG_FAILURES	3
+
+
+/**
+ * @def STK11XX_SLEEP_DELAY
+ *   Time the camera stays configured after the stream stops (ms), before it's put asleep
+ */
+#define STK11XX_SLEEP_DELAY			5000
+
+
+/**
+ * @def STK11XX_REG_INFLIGHT
+ *   Maximum number of asynchronous register writes in flight
+ *
+ * @def STK11XX_REG_TIMEOUT
+ *   Time to wait for the register writes in flight (ms)
+ */
+#define STK11XX_REG_INFLIGHT		8
+#define STK11XX_REG_TIMEOUT			1000
+
+
+/**
+ * @def STK11XX_REG_SHADOW
+ *   Registers 0x0000 up to this one are kept in the shadow of the registers
+ */
+#define STK11XX_REG_SHADOW			0x0400
+
+
+/**
+ * @def STK11XX_POLL_DELAY_MIN
+ *   First delay before a read of the device status (us)
+ *
+ * @def STK11XX_POLL_DELAY_MAX
+ *   Longest delay between two reads of the device status (us)
+ *
+ * @def STK11XX_POLL_TIMEOUT
+ *   Time budget of a device check (ms)
+ *
+ * @def STK11XX_POLL_SITES
+ *   Number of callers of the device check with their own statistics
+ *
+ * @def STK11XX_POLL_BUCKETS
+ *   Buckets of the wait times : below 250 us, 500 us, 1 ms ... and above
+ */
+#define STK11XX_POLL_DELAY_MIN		100
+#define STK11XX_POLL_DELAY_MAX		3200
+#define STK11XX_POLL_TIMEOUT		500
+#define STK11XX_POLL_SITES			32
+#define STK11XX_POLL_BUCKETS		8
+
+
+/**
+ * @def STK11XX_RECORD_SIZE
+ *   Size of the ring of the isoc recorder (bytes, a power of two)
+ *
+ * @def STK11XX_RECORD_HEADER
+ *   Bytes kept from each packet when only the headers are recorded
+ *
+ * @def STK11XX_RECORD_MAGIC
+ *   Magic number of each record ('STKR')
+ */
+#define STK11XX_RECORD_SIZE			(1 << 20)
+#define STK11XX_RECORD_HEADER		8
+#define STK11XX_RECORD_MAGIC		0x524b5453
+
+
+/**
+ * @def STK11XX_REPLAY_MAX
+ *   Maximum number of virtual cameras
+ *
+ * @def STK11XX_REPLAY_SIZE
+ *   Maximum size of the recording played by a virtual camera (bytes)
+ */
+#define STK11XX_REPLAY_MAX			8
+#define STK11XX_REPLAY_SIZE			(64 << 20)
+
+
+/**
+ * @def STK11XX_SIM_TRANSFER_US
+ *   Time of a control transfer to the simulator (us)
+ *
+ * @def STK11XX_SIM_RULES
+ *   Maximum number of rules of the script of the simulator
+ */
+#define STK11XX_SIM_TRANSFER_US		250
+#define STK11XX_SIM_RULES			16
 
 
 
@@ -262,16 +373,23 @@ struct stk11xx_frame_buf {
 	void *data;
 	volatile bool odd;
 	volatile int filled;
-	struct stk11xx_frame_buf *next;
+	u64 timestamp;						/**< Monotonic time of the first packet (ns) */
+	unsigned int sequence;				/**< Sequence number of the frame */
 };
 
 
 /**
- * @struct stk11xx_image_buf
+ * @struct stk11xx_frame_ring
+ *
+ * Lock-free ring of frame buffer indexes. The producer publishes a slot with
+ * a release store on 'head'. Slots are taken by advancing 'tail' with a
+ * compare-and-swap, so the producer can also reclaim the oldest frame when
+ * the consumer falls behind.
  */
-struct stk11xx_image_buf {
-	unsigned long offset;				/**< Memory offset */
-	int vma_use_count;					/**< VMA counter */
+struct stk11xx_frame_ring {
+	unsigned int head;					/**< Next slot to write (producer only) */
+	unsigned int tail;					/**< Next slot to take */
+	unsigned char slot[STK11XX_FRAME_RING_SIZE];	/**< Frame buffer indexes */
 };
 
 
@@ -284,6 +402,214 @@ struct stk11xx_coord {
 };
 
 
+/**
+ * @struct stk11xx_config
+ *
+ * What the camera has been configured for. If it's unchanged and the camera
+ * wasn't reset, the stream is started without initializing the camera again.
+ */
+struct stk11xx_config {
+	int model;							/**< Webcam model */
+	struct stk11xx_coord sensor;		/**< Sensor mode, the resolutions scaled from it share it */
+	int fps;							/**< Frame rate */
+	int norm;							/**< Norm, NTSC or PAL */
+	int input;							/**< Input */
+
+	// Controls : only camera_settings is applied again when they change
+	int brightness;						/**< Brightness */
+	int contrast;						/**< Contrast */
+	int whiteness;						/**< Whiteness */
+	int colour;							/**< Colour */
+	int hflip;							/**< Horizontal flip */
+	int vflip;							/**< Vertical flip */
+};
+
+
+/**
+ * @brief Modes of the isoc recorder
+ */
+typedef enum {
+	STK11XX_RECORD_OFF = 0,				/**< Nothing is recorded */
+	STK11XX_RECORD_HEADERS = 1,			/**< Packet descriptors and headers */
+	STK11XX_RECORD_PAYLOADS = 2			/**< Packet descriptors and whole payloads */
+} T_STK11XX_RECORD_MODE;
+
+
+/**
+ * @brief Types of the records
+ */
+typedef enum {
+	STK11XX_RECORD_START = 1,			/**< The stream starts : struct stk11xx_rec_start follows */
+	STK11XX_RECORD_URB = 2				/**< An isoc URB completed : 'count' struct stk11xx_rec_packet, then the packet bytes */
+} T_STK11XX_RECORD_TYPE;
+
+
+/**
+ * @struct stk11xx_rec_header
+ *
+ * Header of a record of the isoc recorder. The records are read from the
+ * debugfs as a stream, in the byte order of the host.
+ */
+struct stk11xx_rec_header {
+	__u32 magic;						/**< STK11XX_RECORD_MAGIC */
+	__u16 type;							/**< T_STK11XX_RECORD_TYPE */
+	__u16 mode;							/**< T_STK11XX_RECORD_MODE */
+	__u32 size;							/**< Size of the record, this header included */
+	__u32 count;						/**< Number of packets */
+	__s32 status;						/**< Status of the URB */
+	__u32 reserved;
+	__u64 timestamp;					/**< Monotonic time (ns) */
+} __packed;
+
+
+/**
+ * @struct stk11xx_rec_packet
+ */
+struct stk11xx_rec_packet {
+	__s16 status;						/**< Status of the packet */
+	__u16 length;						/**< Actual length of the packet */
+	__u16 recorded;						/**< Bytes of the packet in the record */
+} __packed;
+
+
+/**
+ * @struct stk11xx_rec_start
+ */
+struct stk11xx_rec_start {
+	__u16 model;						/**< Webcam model */
+	__u16 resolution;					/**< Sensor mode */
+	__u16 width;						/**< Width of the sensor mode */
+	__u16 height;						/**< Height of the sensor mode */
+	__u32 frame_size;					/**< Size of a raw frame */
+	__u16 speed;						/**< USB speed */
+	__u16 packet_size;					/**< Maximum size of an isoc packet */
+} __packed;
+
+
+struct usb_stk11xx;
+
+
+/**
+ * @struct stk11xx_bus_ops
+ *
+ * Transfers to the device : the USB camera or the simulator. The register
+ * shadow and the waits for the queued writes are done above.
+ */
+struct stk11xx_bus_ops {
+	int (*write)(struct usb_stk11xx *, __u16, __u16);	/**< Write a register */
+	int (*read)(struct usb_stk11xx *, __u16, int *);	/**< Read a register */
+	int (*set_interface)(struct usb_stk11xx *, int);	/**< Choose the alternate setting */
+	int (*set_feature)(struct usb_stk11xx *, int);		/**< SET_FEATURE */
+	int (*set_configuration)(struct usb_stk11xx *);		/**< SET_CONFIGURATION */
+};
+
+
+/**
+ * @struct stk11xx_sim_rule
+ *
+ * A rule of the simulator : after the write of 'value' to 'reg', the status
+ * register 0x0201 reads 0x00 during 'busy_us', then 'status'.
+ */
+struct stk11xx_sim_rule {
+	__u16 reg;							/**< Register written */
+	__u16 value;						/**< Value written */
+	unsigned int busy_us;				/**< Length of the transaction (us) */
+	__u8 status;						/**< Status at the end of the transaction */
+};
+
+
+/**
+ * @struct stk11xx_sim
+ *
+ * Register-level simulator of the bridge. Its clock is the real time plus
+ * STK11XX_SIM_TRANSFER_US for each transfer.
+ */
+struct stk11xx_sim {
+	__u8 regs[STK11XX_REG_SHADOW];		/**< Registers written */
+	struct stk11xx_sim_rule rules[STK11XX_SIM_RULES];	/**< Script, copied at the attach */
+	int nrules;							/**< Rules of the script */
+	int alternate;						/**< Alternate setting of the interface */
+	__u8 status;						/**< Status at the end of the transaction */
+	u64 busy_until;						/**< End of the transaction (ns of the clock) */
+	ktime_t start;						/**< Start of the clock */
+	u64 bus_ns;							/**< Time of the transfers (ns) */
+	unsigned int writes;				/**< Register writes */
+	unsigned int reads;					/**< Register reads, but the status */
+	unsigned int polls;					/**< Reads of the status 0x0201 */
+	unsigned int interfaces;			/**< Changes of the alternate setting */
+	unsigned int requests;				/**< SET_FEATURE and SET_CONFIGURATION */
+};
+
+
+/**
+ * @struct stk11xx_replay
+ *
+ * A virtual camera : it has no USB device, and plays a recording of the isoc
+ * recorder through the reassembly and the conversion of the frames.
+ */
+struct stk11xx_replay {
+	struct platform_device *pdev;		/**< Device of the virtual camera */
+	struct mutex lock;					/**< Protect the recording and the player */
+	void *data;							/**< Recording, written in the debugfs */
+	size_t size;						/**< Bytes of the recording */
+	size_t alloc;						/**< Allocated size of data */
+	size_t first;						/**< Record of the stream being played */
+	struct task_struct *thread;			/**< Player, while the camera streams */
+	struct urb *urb;					/**< URB given to the reassembly */
+	unsigned char *buffer;				/**< Packets of urb */
+	u32 max_rate;						/**< Play as fast as possible, not at the recorded pace */
+	u32 urbs;							/**< URBs played */
+	u32 loops;							/**< Plays of the whole stream */
+};
+
+
+/**
+ * @struct stk11xx_poll_stat
+ *
+ * Wait times of the device checks made from one place of the code.
+ */
+struct stk11xx_poll_stat {
+	const void *site;					/**< Caller or register sequence, NULL for the others */
+	unsigned int calls;					/**< Number of checks */
+	unsigned int timeouts;				/**< Checks which gave up */
+	unsigned int errors;				/**< Checks which read a bad status */
+	unsigned int max_us;				/**< Longest wait (us) */
+	unsigned long total_us;				/**< Sum of the waits (us) */
+	unsigned int hist[STK11XX_POLL_BUCKETS];	/**< Distribution of the waits */
+};
+
+
+/**
+ * @struct stk11xx_buffer
+ */
+struct stk11xx_buffer {
+	struct vb2_v4l2_buffer vb;			/**< videobuf2 buffer, must be first */
+	struct list_head list;				/**< Entry in the list of queued buffers */
+};
+
+
+/**
+ * @struct stk11xx_fh
+ *
+ * An opened file. Each consumer has its own capture queue, fed with the
+ * frames converted once for all the consumers.
+ */
+struct stk11xx_fh {
+	struct usb_stk11xx *dev;			/**< Device */
+	struct list_head list;				/**< Entry in the list of the opened files */
+
+	struct vb2_queue vb_queue;			/**< Capture buffers queue */
+	struct mutex queue_lock;			/**< Protect vb_queue, taken before modlock */
+	struct list_head buf_list;			/**< Buffers queued by the application */
+	spinlock_t buf_lock;				/**< Protect buf_list */
+
+	int streaming;						/**< The capture buffers are filled */
+	unsigned int sequence_base;			/**< Device sequence of the first frame of the stream */
+	unsigned int frames_done;			/**< Frames given to this consumer */
+	unsigned int frames_dropped;		/**< Frames lost because no buffer was queued */
+};
+
+
 /**
  * @struct stk11xx_video
  */
@@ -319,11 +645,24 @@ struct usb_stk11xx {
 	struct video_device *vdev; 			/**< Pointer on a V4L2 video device */
 	struct usb_device *udev;			/**< Pointer on a USB device */
 	struct usb_interface *interface;	/**< Pointer on a USB interface */
+	struct device *parent;				/**< Parent of the video device */
+	struct stk11xx_replay *replay;		/**< Virtual camera, NULL for a USB camera */
+	const struct stk11xx_bus_ops *bus;	/**< Transfers to the device */
+	struct stk11xx_sim *sim;			/**< Simulator, when it's the bus */
+	enum usb_device_speed speed;		/**< Speed of the isoc stream */
 
 	int release;						/**< Release of the device (bcdDevice) */
 	int webcam_model;					/**< Model of video camera device */
 	int webcam_type;					/**< Type of camera : VGA, SXGA (1.3M), UXGA (2M) */
 
+	struct work_struct init_work;		/**< Initialization of the device, after the probe */
+	struct completion init_done;		/**< Opens wait for the initialization */
+	int init_error;						/**< Result of the initialization, -EIO or -ENODEV once disconnected */
+	ktime_t probe_time;					/**< Start of the probe */
+	unsigned int probe_us;				/**< Duration of the probe (us) */
+	unsigned int init_delay_us;			/**< From the probe to the start of the initialization (us) */
+	unsigned int init_us;				/**< Duration of the initialization (us) */
+
 	unsigned char *int_in_buffer;		/**< Interrupt IN buffer */
 	size_t int_in_size;					/**< Interrupt IN buffer size */
 	__u8 int_in_endpointAddr;			/**< Interrupt IN endpoint address */
@@ -331,25 +670,68 @@ struct usb_stk11xx {
 	size_t isoc_in_size;				/**< Isochrone IN size */
 	__u8 isoc_in_endpointAddr;			/**< Isochrone IN endpoint address */
 
-	int watchdog;						/**< Counter for the software watchdog */
+	int watchdog;						/**< Failed checks in a row of the software watchdog */
+	int watchdog_interval;				/**< Time between two checks of the watchdog (ms) */
+	int watchdog_resets;				/**< Number of stream restarts by the watchdog */
+	struct delayed_work watchdog_work;	/**< Check the camera while it streams */
+
+	int warm;							/**< The camera keeps the configuration of warm_config */
+	struct stk11xx_config warm_config;	/**< Configuration of the camera */
+	struct delayed_work sleep_work;		/**< Put the camera asleep when it stays stopped */
+	int warm_starts;					/**< Number of streams started without initialization */
+	int cold_starts;					/**< Number of streams started with initialization */
 
 	struct stk11xx_video vsettings;		/**< Video settings (brightness, whiteness...) */
 
 	int error_status;
 
-	int vopen;							/**< Video status (Opened or Closed) */
+	int vopen;							/**< Number of opened files */
 	int visoc_errors;					/**< Count the number of ISOCH errors */
 	int vframes_error;					/**< Count the number of fault frames (so dropped) */
 	int vframes_dumped;					/**< Count the number of ignored frames */
+	int frame_rate;						/**< Frame rate delivered to the application, 0 for the full rate of the sensor */
+	unsigned int frame_interval;		/**< Minimal time between two delivered frames (ns), 0 to deliver all of them */
+	u64 frame_due;						/**< Time of the next delivered frame (isoc handler only) */
 	int vsync;							/**< sync on valid frame */
 	int v1st_cap;						/**< used to get a clean 1st capture */
 
 
 	spinlock_t spinlock;				/**< Spin lock */
 	struct semaphore mutex;				/**< Mutex */
-	wait_queue_head_t wait_frame;		/**< Queue head */
 	struct mutex modlock;				/**< To prevent races in video_open(), etc */
 
+	int reg_batch;						/**< Register writes are queued, not waited for */
+	int reg_error;						/**< First error of the queued register writes */
+	atomic_t reg_inflight;				/**< Queued register writes not completed */
+	wait_queue_head_t reg_wait;			/**< Woken up when a register write completes */
+	struct usb_anchor reg_anchor;		/**< Queued register writes */
+	__u8 reg_shadow[STK11XX_REG_SHADOW];	/**< Last known values of the registers */
+	unsigned long reg_shadow_valid[BITS_TO_LONGS(STK11XX_REG_SHADOW)];	/**< Registers known in reg_shadow */
+	unsigned int reg_writes_saved;		/**< Writes elided by the shadow */
+	unsigned int reg_reads_saved;		/**< Reads served by the shadow */
+	struct stk11xx_poll_stat poll_stats[STK11XX_POLL_SITES];	/**< Wait times of the device checks */
+
+	struct dentry *debugfs;				/**< Directory of the device in the debugfs */
+	int rec_mode;						/**< Mode of the isoc recorder */
+	spinlock_t rec_lock;				/**< Protect the writer of the recorder against a mode change */
+	struct mutex rec_mutex;				/**< Protect the reader of the recorder against a mode change */
+	struct kfifo rec_fifo;				/**< Records not read yet */
+	void *rec_buffer;					/**< Memory of rec_fifo */
+	wait_queue_head_t rec_wait;			/**< Woken up by a new record */
+	u32 rec_urbs;						/**< URBs recorded */
+	u32 rec_lost;						/**< URBs not recorded : the ring was full */
+	struct mutex fh_lock;				/**< Protect fh_list and the consumers, taken after modlock */
+	struct list_head fh_list;			/**< Opened files */
+	struct stk11xx_fh *owner;			/**< File which owns the format, or NULL */
+	int buffers_allocated;				/**< Capture buffers of all the files, under modlock */
+
+
+	// 0: buffer pool, kept across open/close
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,7,0)
+	struct shrinker *shrinker;			/**< Release the pool under memory pressure */
+#else
+	struct shrinker shrinker;			/**< Release the pool under memory pressure */
+#endif
 
 	// 1: isoc
 	char isoc_init_ok;
@@ -357,22 +739,20 @@ struct usb_stk11xx {
 
 	// 2: frame
 	int frame_size;
+	int framebuf_size;					/**< Allocated size of each frame buffer */
 	struct stk11xx_frame_buf *framebuf;
-	struct stk11xx_frame_buf *empty_frames, *empty_frames_tail;
-	struct stk11xx_frame_buf *full_frames, *full_frames_tail;
-	struct stk11xx_frame_buf *fill_frame;
-	struct stk11xx_frame_buf *read_frame;
+	struct stk11xx_frame_ring free_ring;	/**< Frames released by the consumer */
+	struct stk11xx_frame_ring full_ring;	/**< Frames completed by the isoc handler */
+	struct stk11xx_frame_buf *fill_frame;	/**< Frame being filled (isoc handler only) */
+	struct stk11xx_frame_buf *read_frame;	/**< Frame being converted (consumer only) */
+	struct work_struct frame_work;		/**< Convert the completed frames */
+	unsigned int frame_sequence;		/**< Sequence number of the next completed frame */
 
 	// 3: image
 	int view_size;
 	int image_size;
-	void *image_data;
-	struct stk11xx_image_buf images[STK11XX_MAX_IMAGES];
-	int image_used[STK11XX_MAX_IMAGES];
-	unsigned int nbuffers;
-	unsigned int len_per_image;
-	int image_read_pos;
-	int fill_image;
+	int streaming;						/**< Number of consumers streaming, the camera runs while not 0 */
+	void *read_image;					/**< Image being filled (consumer only) */
 	int resolution;
 	struct stk11xx_coord view;
 	struct stk11xx_coord image;
@@ -394,21 +774,39 @@ struct usb_stk11xx {
 
 
 extern const struct stk11xx_coord stk11xx_image_sizes[STK11XX_NBR_SIZES];
+extern const struct stk11xx_bus_ops usb_stk11xx_bus_ops;
+extern const struct stk11xx_bus_ops stk11xx_sim_bus_ops;
 
 	
 int usb_stk11xx_write_registry(struct usb_stk11xx *, __u16, __u16);
 int usb_stk11xx_read_registry(struct usb_stk11xx *, __u16, int *);
+void usb_stk11xx_begin_registry(struct usb_stk11xx *);
+int usb_stk11xx_end_registry(struct usb_stk11xx *);
+void usb_stk11xx_wait_registry(struct usb_stk11xx *);
+void usb_stk11xx_kill_registry(struct usb_stk11xx *);
+void usb_stk11xx_invalidate_registry(struct usb_stk11xx *);
 int usb_stk11xx_set_feature(struct usb_stk11xx *, int);
 int usb_stk11xx_set_configuration(struct usb_stk11xx *);
+int usb_stk11xx_set_interface(struct usb_stk11xx *, int);
+int usb_stk11xx_default_settings(struct usb_stk11xx *);
+int usb_stk11xx_initialize(struct usb_stk11xx *);
 int usb_stk11xx_isoc_init(struct usb_stk11xx *);
+void usb_stk11xx_isoc_packets(struct usb_stk11xx *, struct urb *);
 void usb_stk11xx_isoc_handler(struct urb *);
 void usb_stk11xx_isoc_cleanup(struct usb_stk11xx *);
+struct usb_stk11xx * usb_stk11xx_alloc(int, int);
+int usb_stk11xx_register(struct usb_stk11xx *);
+void usb_stk11xx_unregister(struct usb_stk11xx *);
 
 int dev_stk11xx_decompress(struct usb_stk11xx *);
 int dev_stk11xx_initialize_device(struct usb_stk11xx *);
 int dev_stk11xx_start_stream(struct usb_stk11xx *);
 int dev_stk11xx_stop_stream(struct usb_stk11xx *);
+int dev_stk11xx_start_video(struct usb_stk11xx *);
+int dev_stk11xx_stop_video(struct usb_stk11xx *);
+void dev_stk11xx_sleep(struct usb_stk11xx *);
 int dev_stk11xx_check_device(struct usb_stk11xx *, int);
+int dev_stk11xx_poll_device(struct usb_stk11xx *, int, const void *);
 int dev_stk11xx_camera_on(struct usb_stk11xx *);
 int dev_stk11xx_camera_off(struct usb_stk11xx *);
 int dev_stk11xx_camera_asleep(struct usb_stk11xx *);
@@ -417,7 +815,11 @@ int dev_stk11xx_reconf_camera(struct usb_stk11xx *);
 int dev_stk11xx_camera_settings(struct usb_stk11xx *);
 int dev_stk11xx_set_camera_quality(struct usb_stk11xx *);
 int dev_stk11xx_set_camera_fps(struct usb_stk11xx *);
+int dev_stk11xx_frame_rates(struct usb_stk11xx *, int, const int **);
+int dev_stk11xx_set_frame_rate(struct usb_stk11xx *, int);
 int dev_stk11xx_watchdog_camera(struct usb_stk11xx *);
+void dev_stk11xx_init_watchdog(struct usb_stk11xx *);
+void dev_stk11xx_init_sleep(struct usb_stk11xx *);
 
 int v4l_stk11xx_select_video_mode(struct usb_stk11xx *, int, int);
 int v4l_stk11xx_register_video_device(struct usb_stk11xx *);
@@ -426,12 +828,32 @@ int v4l_stk11xx_unregister_video_device(struct usb_stk11xx *);
 int stk11xx_create_sysfs_files(struct video_device *);
 void stk11xx_remove_sysfs_files(struct video_device *);
 
+void stk11xx_debugfs_init(void);
+void stk11xx_debugfs_exit(void);
+void stk11xx_create_debugfs(struct usb_stk11xx *);
+void stk11xx_remove_debugfs(struct usb_stk11xx *);
+void stk11xx_record_start(struct usb_stk11xx *);
+void stk11xx_record_urb(struct usb_stk11xx *, struct urb *);
+
+int stk11xx_replay_init(int);
+void stk11xx_replay_exit(void);
+int stk11xx_replay_start(struct usb_stk11xx *);
+void stk11xx_replay_stop(struct usb_stk11xx *);
+
+int stk11xx_sim_attach(struct usb_stk11xx *);
+void stk11xx_sim_detach(struct usb_stk11xx *);
+void stk11xx_sim_create_debugfs(struct dentry *);
+
 int stk11xx_allocate_buffers(struct usb_stk11xx *);
 int stk11xx_reset_buffers(struct usb_stk11xx *);
-int stk11xx_clear_buffers(struct usb_stk11xx *);
 int stk11xx_free_buffers(struct usb_stk11xx *);
-void stk11xx_next_image(struct usb_stk11xx *);
+int stk11xx_register_buffer_pool(struct usb_stk11xx *);
+void stk11xx_unregister_buffer_pool(struct usb_stk11xx *);
+void stk11xx_init_consumers(struct usb_stk11xx *);
+int stk11xx_init_queue(struct stk11xx_fh *);
+int stk11xx_frame_wanted(struct usb_stk11xx *, struct stk11xx_frame_buf *);
 int stk11xx_next_frame(struct usb_stk11xx *);
+int stk11xx_frame_ready(struct usb_stk11xx *);
 int stk11xx_handle_frame(struct usb_stk11xx *);
 
 int stk11xx_decompress(struct usb_stk11xx *);